@@ -0,0 +1,85 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "cpustat.h"
+
+#define NCPU   8
+#define NSPIN  20000000
+
+struct cpustat before[NCPU], after[NCPU];
+
+// Sum the migrations of n CPUs.
+int
+migrations(struct cpustat *st, int n)
+{
+  int i, m;
+
+  m = 0;
+  for(i = 0; i < n; i++)
+    m += st[i].nmigrate;
+  return m;
+}
+
+// Pin one CPU-bound child to each CPU, and check that while
+// every runnable process is pinned, none of them moves.
+int
+main(int argc, char *argv[])
+{
+  int ncpu, i, old, ready[2], go[2];
+  volatile int x;
+  char c;
+
+  printf(1, "\n   ***Testing CPU affinity***\n");
+
+  ncpu = getcpustat(before, NCPU);
+  if(ncpu > NCPU)
+    ncpu = NCPU;
+  if((old = sched_setaffinity(getpid(), 1)) <= 0){
+    printf(1, "sched_setaffinity failed\n");
+    exit();
+  }
+  if(sched_setaffinity(getpid(), 0) != -1 ||
+     (ncpu < 32 && sched_setaffinity(getpid(), ~0 << ncpu) != -1) ||
+     sched_setaffinity(-1, 1) != -1 || sched_setaffinity(getpid(), 1) != 1){
+    printf(1, "sched_setaffinity accepted a bad request\n");
+    exit();
+  }
+
+  pipe(ready);
+  pipe(go);
+  for(i = 0; i < ncpu; i++){
+    if(fork() == 0){
+      // The mask is inherited.
+      if(sched_setaffinity(getpid(), 1 << i) != 1){
+        printf(1, "child did not inherit its mask\n");
+        exit();
+      }
+      write(ready[1], "r", 1);
+      read(go[0], &c, 1);
+      for(x = 0; x < NSPIN; x++)
+        ;
+      exit();
+    }
+  }
+  for(i = 0; i < ncpu; i++)
+    read(ready[0], &c, 1);
+
+  getcpustat(before, ncpu);
+  for(i = 0; i < ncpu; i++)
+    write(go[1], "g", 1);
+  for(i = 0; i < ncpu; i++)
+    wait();
+  getcpustat(after, ncpu);
+
+  for(i = 0; i < ncpu; i++)
+    printf(1, "cpu %d: %d switches, %d migrations\n", i,
+           after[i].nswitch - before[i].nswitch,
+           after[i].nmigrate - before[i].nmigrate);
+  if(migrations(after, ncpu) != migrations(before, ncpu)){
+    printf(1, "pinned processes migrated\n");
+    exit();
+  }
+  sched_setaffinity(getpid(), old);
+  printf(1, "%d pinned processes stayed on their CPUs: ok\n", ncpu);
+  exit();
+}
@@ -0,0 +1,74 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "fcntl.h"
+#include "bcstat.h"
+
+#define NBLOCK  130   // more than the static buffers
+#define BSIZE   512
+
+char buf[BSIZE];
+
+// Read the whole file back, checking its contents.
+int
+readback(char *name)
+{
+  int fd, i;
+
+  if((fd = open(name, O_RDONLY)) < 0)
+    return -1;
+  for(i = 0; i < NBLOCK; i++){
+    if(read(fd, buf, BSIZE) != BSIZE || buf[0] != (char)i){
+      close(fd);
+      return -1;
+    }
+  }
+  close(fd);
+  return 0;
+}
+
+// Write a file larger than the static cache and read it twice:
+// the cache should grow to hold it, so the second pass hits.
+int
+main(int argc, char *argv[])
+{
+  struct bcstat before, after;
+  int fd, i;
+
+  printf(1, "\n   ***Testing the buffer cache***\n");
+
+  if((fd = open("bcache.tmp", O_CREATE|O_RDWR)) < 0){
+    printf(1, "open failed\n");
+    exit();
+  }
+  for(i = 0; i < NBLOCK; i++){
+    memset(buf, i, BSIZE);
+    if(write(fd, buf, BSIZE) != BSIZE){
+      printf(1, "write failed\n");
+      exit();
+    }
+  }
+  close(fd);
+
+  if(readback("bcache.tmp") < 0){
+    printf(1, "read failed\n");
+    exit();
+  }
+  getbcstat(&before);
+  if(readback("bcache.tmp") < 0){
+    printf(1, "read failed\n");
+    exit();
+  }
+  getbcstat(&after);
+  unlink("bcache.tmp");
+
+  printf(1, "%d/%d buffers, second pass: %d hits, %d misses\n", after.nbuf,
+         after.maxbuf, after.hits - before.hits, after.misses - before.misses);
+  if(after.nbuf < NBLOCK || after.hits - before.hits < NBLOCK ||
+     after.misses - before.misses > NBLOCK/10){
+    printf(1, "the cache did not grow to hold the file\n");
+    exit();
+  }
+  printf(1, "buffer cache grew: ok\n");
+  exit();
+}
@@ -0,0 +1,8 @@
+// Buffer cache counters, as returned by getbcstat().
+struct bcstat {
+  uint hits;       // Lookups that found the block cached
+  uint misses;     // Lookups that had to go to the disk
+  int nbuf;        // Buffers, static and dynamic
+  int maxbuf;      // Most buffers it may grow to
+  uint shrunk;     // Buffers given back under memory pressure
+};
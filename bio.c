@@ -1,6 +1,6 @@
 // Buffer cache.
 //
-// The buffer cache is a linked list of buf structures holding
+// The buffer cache is a hash table of buf structures holding
 // cached copies of disk block contents.  Caching disk blocks
 // in memory reduces the number of disk reads and also provides
 // a synchronization point for disk blocks used by multiple processes.
@@ -21,75 +21,276 @@
 #include "types.h"
 #include "defs.h"
 #include "param.h"
+#include "mmu.h"
 #include "spinlock.h"
 #include "sleeplock.h"
 #include "fs.h"
 #include "buf.h"
+#include "kalloc.h"
+#include "bcstat.h"
+
+// Cached blocks are found through a hash table on (dev, blockno)
+// whose buckets have their own locks, so lookups of different
+// blocks do not contend. Buffers nobody holds (refcnt 0) are also
+// on an LRU list, under lrulock; bget() recycles the least
+// recently used one. Recycling moves a buffer between buckets, so
+// it is serialized by bcache.lock, taken before the bucket locks;
+// lrulock is taken last. Only a recycler holds two bucket locks.
+//
+// The NBUF static buffers are a floor. Beyond them, a miss takes a
+// new buffer from a slab cache while the cache is smaller than
+// 1/BCACHEFRAC of memory and more than that much memory is free,
+// and recycles one otherwise. bshrink() gives dynamic buffers back
+// when user allocations run out of memory.
+#define NBHASH 61
+
+struct bucket {
+  struct spinlock lock;
+  struct buf *head;     // through hnext
+  uint hits;
+  uint misses;
+};
 
 struct {
   struct spinlock lock;
   struct buf buf[NBUF];
+  struct bucket hash[NBHASH];
+  struct kmcache *cache;  // dynamic buffers
+  int nbuf;               // buffers, static and dynamic
+  uint shrunk;            // dynamic buffers freed by bshrink()
 
-  // Linked list of all buffers, through prev/next.
-  // head.next is most recently used.
-  struct buf head;
+  // Linked list of unused buffers, through prev/next.
+  // lru.next is most recently used.
+  struct spinlock lrulock;
+  struct buf lru;
 } bcache;
 
+static struct bucket*
+bhash(uint dev, uint blockno)
+{
+  return &bcache.hash[(dev*31 + blockno) % NBHASH];
+}
+
+// Insert b at the head of the LRU list. Caller must hold lrulock.
+static void
+lrupush(struct buf *b)
+{
+  b->next = bcache.lru.next;
+  b->prev = &bcache.lru;
+  bcache.lru.next->prev = b;
+  bcache.lru.next = b;
+}
+
+// Remove b from the LRU list. Caller must hold lrulock.
+static void
+lrudel(struct buf *b)
+{
+  b->next->prev = b->prev;
+  b->prev->next = b->next;
+}
+
+static void
+bufctor(void *obj)
+{
+  struct buf *b = obj;
+
+  initsleeplock(&b->lock, "buffer");
+  b->done = 0;
+}
+
 void
 binit(void)
 {
   struct buf *b;
+  int i;
 
   initlock(&bcache.lock, "bcache");
+  if((bcache.cache = kmcache_create("buf", sizeof(struct buf), bufctor)) == 0)
+    panic("binit");
+  bcache.nbuf = NBUF;
+  initlock(&bcache.lrulock, "bcache.lru");
+  for(i = 0; i < NBHASH; i++)
+    initlock(&bcache.hash[i].lock, "bcache.bucket");
 
 //PAGEBREAK!
-  // Create linked list of buffers
-  bcache.head.prev = &bcache.head;
-  bcache.head.next = &bcache.head;
+  // All buffers start out unused, in no bucket.
+  bcache.lru.prev = &bcache.lru;
+  bcache.lru.next = &bcache.lru;
   for(b = bcache.buf; b < bcache.buf+NBUF; b++){
-    b->next = bcache.head.next;
-    b->prev = &bcache.head;
     initsleeplock(&b->lock, "buffer");
-    bcache.head.next->prev = b;
-    bcache.head.next = b;
+    lrupush(b);
   }
 }
 
-// Look through buffer cache for block on device dev.
-// If not found, allocate a buffer.
-// In either case, return locked buffer.
+// Return the buffer for dev/blockno in bk, with a reference
+// taken, or 0. Caller must hold bk->lock.
 static struct buf*
-bget(uint dev, uint blockno)
+bfind(struct bucket *bk, uint dev, uint blockno)
 {
   struct buf *b;
 
-  acquire(&bcache.lock);
-
-  // Is the block already cached?
-  for(b = bcache.head.next; b != &bcache.head; b = b->next){
+  for(b = bk->head; b; b = b->hnext){
     if(b->dev == dev && b->blockno == blockno){
-      b->refcnt++;
-      release(&bcache.lock);
-      acquiresleep(&b->lock);
+      if(b->refcnt++ == 0){
+        acquire(&bcache.lrulock);
+        lrudel(b);
+        release(&bcache.lrulock);
+      }
+      bk->hits++;
       return b;
     }
   }
+  return 0;
+}
+
+static int
+isdynamic(struct buf *b)
+{
+  return b < bcache.buf || b >= bcache.buf+NBUF;
+}
+
+// Take an unused, clean buffer off the LRU list and out of its
+// bucket, least recently used first, or return 0. With dynonly,
+// only take dynamic buffers. Caller must hold bcache.lock, and
+// bk->lock unless bk is 0.
+static struct buf*
+brecycle(struct bucket *bk, int dynonly)
+{
+  struct buf *b, **pp;
+  struct bucket *old;
 
-  // Not cached; recycle an unused buffer.
+  for(;;){
+    acquire(&bcache.lrulock);
+    for(b = bcache.lru.prev; b != &bcache.lru; b = b->prev)
+      if((b->flags & B_DIRTY) == 0 && (!dynonly || isdynamic(b)))
+        break;
+    release(&bcache.lrulock);
+    if(b == &bcache.lru)
+      return 0;
+
+    // b's identity only changes under bcache.lock, so old is
+    // stable, but b may be found and taken before old is locked.
+    old = b->flags & B_HASHED ? bhash(b->dev, b->blockno) : bk;
+    if(old && old != bk)
+      acquire(&old->lock);
+    if(b->refcnt == 0 && (b->flags & B_DIRTY) == 0){
+      acquire(&bcache.lrulock);
+      lrudel(b);
+      release(&bcache.lrulock);
+      if(b->flags & B_HASHED){
+        for(pp = &old->head; *pp != b; pp = &(*pp)->hnext)
+          ;
+        *pp = b->hnext;
+      }
+      if(old && old != bk)
+        release(&old->lock);
+      return b;
+    }
+    if(old && old != bk)
+      release(&old->lock);
+  }
+}
+
+// Return a new dynamic buffer if the cache may grow, or 0.
+// Caller must hold bcache.lock.
+static struct buf*
+bgrow(void)
+{
+  uint npages = free_page_counts.num_init_free_pages;
+  struct buf *b;
+
+  if(bcache.nbuf >= NBUF + npages/BCACHEFRAC * (PGSIZE/sizeof(struct buf)) ||
+     free_page_counts.num_curr_free_pages <= npages/BCACHEFRAC)
+    return 0;
+  if((b = kmcache_alloc(bcache.cache)) == 0)
+    return 0;
+  bcache.nbuf++;
+  return b;
+}
+
+// Memory is short: free up to half the dynamic buffers,
+// least recently used first, if unused and clean.
+// Return the number freed.
+int
+bshrink(void)
+{
+  struct buf *b;
+  int n;
+
+  acquire(&bcache.lock);
+  for(n = 0; n < (bcache.nbuf - NBUF + 1)/2; n++){
+    if((b = brecycle(0, 1)) == 0)
+      break;
+    kmcache_free(bcache.cache, b);
+    bcache.nbuf--;
+  }
+  bcache.shrunk += n;
+  release(&bcache.lock);
+  return n;
+}
+
+// Copy the buffer cache counters to st.
+void
+bcachestat(struct bcstat *st)
+{
+  int i;
+
+  st->hits = st->misses = 0;
+  for(i = 0; i < NBHASH; i++){
+    st->hits += bcache.hash[i].hits;
+    st->misses += bcache.hash[i].misses;
+  }
+  st->nbuf = bcache.nbuf;
+  st->maxbuf = NBUF + free_page_counts.num_init_free_pages/BCACHEFRAC *
+               (PGSIZE/sizeof(struct buf));
+  st->shrunk = bcache.shrunk;
+}
+
+// Look through buffer cache for block on device dev.
+// If not found, allocate a buffer.
+// In either case, return locked buffer. If every buffer is
+// in use, panic, or return 0 when only reading ahead.
+static struct buf*
+bget(uint dev, uint blockno, int ahead)
+{
+  struct bucket *bk = bhash(dev, blockno);
+  struct buf *b;
+
+  // Is the block already cached?
+  acquire(&bk->lock);
+  if((b = bfind(bk, dev, blockno)) != 0){
+    release(&bk->lock);
+    acquiresleep(&b->lock);
+    return b;
+  }
+  release(&bk->lock);
+
+  // Not cached; recycle an unused buffer. Look again once
+  // recycling is ours: someone may have cached it meanwhile.
   // Even if refcnt==0, B_DIRTY indicates a buffer is in use
   // because log.c has modified it but not yet committed it.
-  for(b = bcache.head.prev; b != &bcache.head; b = b->prev){
-    if(b->refcnt == 0 && (b->flags & B_DIRTY) == 0) {
-      b->dev = dev;
-      b->blockno = blockno;
-      b->flags = 0;
-      b->refcnt = 1;
+  acquire(&bcache.lock);
+  acquire(&bk->lock);
+  if((b = bfind(bk, dev, blockno)) == 0){
+    bk->misses++;
+    if((b = bgrow()) == 0 && (b = brecycle(bk, 0)) == 0){
+      if(!ahead)
+        panic("bget: no buffers");
+      release(&bk->lock);
       release(&bcache.lock);
-      acquiresleep(&b->lock);
-      return b;
+      return 0;
     }
+    b->dev = dev;
+    b->blockno = blockno;
+    b->flags = B_HASHED;
+    b->refcnt = 1;
+    b->hnext = bk->head;
+    bk->head = b;
   }
-  panic("bget: no buffers");
+  release(&bk->lock);
+  release(&bcache.lock);
+  acquiresleep(&b->lock);
+  return b;
 }
 
 // Return a locked buf with the contents of the indicated block.
@@ -98,13 +299,108 @@ bread(uint dev, uint blockno)
 {
   struct buf *b;
 
-  b = bget(dev, blockno);
+  b = bget(dev, blockno, 0);
   if((b->flags & B_VALID) == 0) {
-    iderw(b);
+    bsubmit(b);
+    bwait(b);
   }
   return b;
 }
 
+// Return a locked buf for a block the caller is about to
+// overwrite entirely, without reading it from disk. Unless
+// the block was cached, the data is garbage until then.
+struct buf*
+boverwrite(uint dev, uint blockno)
+{
+  struct buf *b;
+
+  b = bget(dev, blockno, 0);
+  b->flags |= B_VALID;
+  return b;
+}
+
+// Release b on behalf of whoever locked it.
+static void
+bput(struct buf *b)
+{
+  struct bucket *bk;
+
+  releasesleep(&b->lock);
+
+  bk = bhash(b->dev, b->blockno);
+  acquire(&bk->lock);
+  b->refcnt--;
+  if (b->refcnt == 0) {
+    // no one is waiting for it.
+    acquire(&bcache.lrulock);
+    lrupush(b);
+    release(&bcache.lrulock);
+  }
+  release(&bk->lock);
+}
+
+// Completion of a read-ahead, from the disk interrupt:
+// release the buffer for the process that started it.
+static void
+aheaddone(struct buf *b)
+{
+  b->done = 0;
+  bput(b);
+}
+
+// Start reading the indicated block into the cache, unless it is
+// there already, without waiting for it. The buffer stays locked
+// until the read completes, so bread() of it waits until then.
+void
+breadahead(uint dev, uint blockno)
+{
+  struct bucket *bk = bhash(dev, blockno);
+  struct buf *b;
+
+  acquire(&bk->lock);
+  for(b = bk->head; b; b = b->hnext)
+    if(b->dev == dev && b->blockno == blockno)
+      break;
+  release(&bk->lock);
+  if(b)
+    return;
+
+  if((b = bget(dev, blockno, 1)) == 0)
+    return;
+  if(b->flags & B_VALID)
+    brelse(b);
+  else {
+    b->done = aheaddone;
+    bsubmit(b);
+  }
+}
+
+// Start the I/O for a locked buffer without waiting: write it
+// if B_DIRTY is set, else read it. Several buffers can be
+// submitted before waiting for them with bwait(). If b->done
+// is set, the disk interrupt calls it instead.
+void
+bsubmit(struct buf *b)
+{
+  if(!holdingsleep(&b->lock))
+    panic("bsubmit");
+  if(virtiodisk(b->dev))
+    virtiosubmit(b);
+  else
+    idesubmit(b);
+}
+
+// Wait for the I/O submitted for b to finish.
+void
+bwait(struct buf *b)
+{
+  if(virtiodisk(b->dev))
+    virtioawait(b);
+  else
+    ideawait(b);
+}
+
 // Write b's contents to disk.  Must be locked.
 void
 bwrite(struct buf *b)
@@ -112,33 +408,18 @@ bwrite(struct buf *b)
   if(!holdingsleep(&b->lock))
     panic("bwrite");
   b->flags |= B_DIRTY;
-  iderw(b);
+  bsubmit(b);
+  bwait(b);
 }
 
 // Release a locked buffer.
-// Move to the head of the MRU list.
+// Move to the head of the LRU list once unused.
 void
 brelse(struct buf *b)
 {
   if(!holdingsleep(&b->lock))
     panic("brelse");
-
-  releasesleep(&b->lock);
-
-  acquire(&bcache.lock);
-  b->refcnt--;
-  if (b->refcnt == 0) {
-    // no one is waiting for it.
-    b->next->prev = b->prev;
-    b->prev->next = b->next;
-    b->next = bcache.head.next;
-    b->prev = &bcache.head;
-    bcache.head.next->prev = b;
-    bcache.head.next = b;
-  }
-  
-  release(&bcache.lock);
+  bput(b);
 }
 //PAGEBREAK!
 // Blank page.
-
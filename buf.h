@@ -4,11 +4,14 @@ struct buf {
   uint blockno;
   struct sleeplock lock;
   uint refcnt;
-  struct buf *prev; // LRU cache list
+  struct buf *prev; // LRU list, while unused
   struct buf *next;
+  struct buf *hnext; // hash bucket
   struct buf *qnext; // disk queue
+  void (*done)(struct buf*); // called when the disk is done, or 0
   uchar data[BSIZE];
 };
 #define B_VALID 0x2  // buffer has been read from disk
 #define B_DIRTY 0x4  // buffer needs to be written to disk
+#define B_HASHED 0x8 // buffer is in a hash bucket (bio.c)
 
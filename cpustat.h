@@ -0,0 +1,11 @@
+// Per-CPU scheduling counters, as returned by getcpustat().
+// Times are in TSC cycles.
+struct cpustat {
+  uint nswitch;      // Processes switched to
+  uint nmigrate;     // Of those, ones that last ran on another CPU
+  int nqueued;       // RUNNABLE processes waiting in its run queue
+  int idle;          // Halted, waiting for work
+  uint64 busytime;   // Time spent running processes
+  uint64 idletime;   // Time spent in the scheduler or halted
+  uint64 swtchtime;  // Time spent switching to processes
+};
@@ -1,19 +1,33 @@
+struct bcstat;
 struct buf;
 struct context;
+struct cpustat;
+struct fdtable;
 struct file;
 struct inode;
+struct kmcache;
 struct pipe;
+struct pcidev;
 struct proc;
+struct procstat;
 struct rtcdate;
 struct spinlock;
 struct sleeplock;
 struct stat;
 struct superblock;
+struct timer;
+struct vmspace;
 
 // bio.c
+void            bcachestat(struct bcstat*);
 void            binit(void);
+struct buf*     boverwrite(uint, uint);
 struct buf*     bread(uint, uint);
+void            breadahead(uint, uint);
 void            brelse(struct buf*);
+void            bsubmit(struct buf*);
+void            bwait(struct buf*);
+int             bshrink(void);
 void            bwrite(struct buf*);
 
 // console.c
@@ -26,6 +40,9 @@ void            panic(char*) __attribute__((noreturn));
 int             exec(char*, char**);
 
 // file.c
+struct fdtable* fdtalloc(struct fdtable*);
+struct fdtable* fdtdup(struct fdtable*);
+void            fdtput(struct fdtable*);
 struct file*    filealloc(void);
 void            fileclose(struct file*);
 struct file*    filedup(struct file*);
@@ -50,17 +67,19 @@ int             namecmp(const char*, const char*);
 struct inode*   namei(char*);
 struct inode*   nameiparent(char*, char*);
 int             readi(struct inode*, char*, uint, uint);
+uint            readahead(struct inode*, uint, uint);
 void            stati(struct inode*, struct stat*);
 int             writei(struct inode*, char*, uint, uint);
-int             createSwapFile(struct proc* p);
-int             readFromSwapFile(struct proc* p, char* buffer, uint placOnFile, uint size);
-int             writeToSwapFile(struct proc* p, char* buffer, uint placeOnFile, uint size);
-int             removeSwapFile(struct proc* p);
+int             createSwapFile(struct vmspace* vm, int pid);
+int             readFromSwapFile(struct vmspace* vm, char* buffer, uint placOnFile, uint size);
+int             writeToSwapFile(struct vmspace* vm, char* buffer, uint placeOnFile, uint size);
+int             removeSwapFile(struct vmspace* vm);
 
 // ide.c
 void            ideinit(void);
 void            ideintr(void);
-void            iderw(struct buf*);
+void            ideawait(struct buf*);
+void            idesubmit(struct buf*);
 
 // ioapic.c
 void            ioapicenable(int irq, int cpu);
@@ -70,6 +89,8 @@ void            ioapicinit(void);
 // kalloc.c
 char*           kalloc(void);
 void            kfree(char*);
+char*           kallocpages(int);
+void            kfreepages(char*, int);
 void            kinit1(void*, void*);
 void            kinit2(void*, void*);
 
@@ -83,6 +104,9 @@ extern volatile uint*    lapic;
 void            lapiceoi(void);
 void            lapicinit(void);
 void            lapicstartap(uchar, uint);
+void            lapiconeshot(uint);
+uint            lapicperiodic(void);
+void            lapicipi(int, int);
 void            microdelay(int);
 
 // log.c
@@ -99,19 +123,49 @@ void            mpinit(void);
 void            picenable(int);
 void            picinit(void);
 
+// pci.c
+void            pcienable(struct pcidev*);
+int             pcifind(struct pcidev*, int, int, int, int);
+uint            pciread(struct pcidev*, int);
+void            pciwrite(struct pcidev*, int, uint);
+
 // pipe.c
 int             pipealloc(struct file**, struct file**);
+void            pipeinit(void);
 void            pipeclose(struct pipe*, int);
 int             piperead(struct pipe*, char*, int);
 int             pipewrite(struct pipe*, char*, int);
 
+// slab.c
+void            slabinit(void);
+struct kmcache* kmcache_create(char*, uint, void (*)(void*));
+void*           kmcache_alloc(struct kmcache*);
+void            kmcache_free(struct kmcache*, void*);
+
+// shm.c
+void            shminit(void);
+int             shmget(int, int);
+char*           shmat(int);
+int             shmdt(char*);
+int             shmfork(struct vmspace*, struct vmspace*);
+void            shmexit(struct vmspace*);
+
 //PAGEBREAK: 16
 // proc.c
+int             clone(void(*)(void*), void*, void*);
 int             cpuid(void);
 void            exit(void);
 int             fork(void);
+int             getcpustat(struct cpustat*, int);
+int             getprocstat(struct procstat*, int);
 int             growproc(int);
+int             join(void**);
 int             kill(int);
+int             killthreads(void);
+int             oomkill(void);
+int             sched_setaffinity(int, uint);
+int             setpriority(int, int);
+void            schedtick(void);
 struct cpu*     mycpu(void);
 struct proc*    myproc();
 void            pinit(void);
@@ -120,12 +174,15 @@ void            scheduler(void) __attribute__((noreturn));
 void            sched(void);
 void            setproc(struct proc*);
 void            sleep(void*, struct spinlock*);
+void            tlbflush(struct vmspace*);
 void            userinit(void);
+struct vmspace* vmalloc(void);
+void            vmput(struct vmspace*);
 int             wait(void);
 void            wakeup(void*);
 void            yield(void);
 void            custom_proc_print(struct proc*);
-void            updateNFUState(void);
+void            updateNFUState(uint);
 
 // swtch.S
 void            swtch(struct context**, struct context*);
@@ -169,7 +226,17 @@ int             isdirempty(struct inode *dp);
 // timer.c
 void            timerinit(void);
 
+// timer.c
+void            timerinit(void);
+void            timeradd(struct timer*, uint);
+int             timerdel(struct timer*);
+void            timertick(void);
+uint            timernext(void);
+
 // trap.c
+void            timerresume(void);
+void            timersync(void);
+void            timerwake(uint);
 void            idtinit(void);
 extern uint     ticks;
 void            tvinit(void);
@@ -180,6 +247,14 @@ void            uartinit(void);
 void            uartintr(void);
 void            uartputc(int);
 
+// virtio.c
+extern int      virtioirq;
+void            virtioawait(struct buf*);
+int             virtiodisk(uint);
+void            virtioinit(void);
+void            virtiointr(void);
+void            virtiosubmit(struct buf*);
+
 // vm.c
 void            seginit(void);
 void            kvmalloc(void);
@@ -194,8 +269,14 @@ pde_t*          copyuvm(pde_t*, uint);
 void            switchuvm(struct proc*);
 void            switchkvm(void);
 int             copyout(pde_t*, uint, void*, uint);
+int             copyoutvm(struct vmspace*, uint, void*, uint);
 void            clearpteu(pde_t *pgdir, char *uva);
-void            swapPages(uint);
+pte_t*          walkpgdir(pde_t*, const void*, int);
+int             mappages(pde_t*, void*, uint, uint, int);
+int             swapPages(uint);
+int             mlock(char*, uint);
+int             munlock(char*, uint);
+int             madvise(char*, uint, int);
 
 // number of elements in fixed-size array
 #define NELEM(x) (sizeof(x)/sizeof((x)[0]))
@@ -3,6 +3,9 @@
 #include "memlayout.h"
 #include "mmu.h"
 #include "proc.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "vmspace.h"
 #include "defs.h"
 #include "x86.h"
 #include "elf.h"
@@ -16,7 +19,8 @@ exec(char *path, char **argv)
   struct elfhdr elf;
   struct inode *ip;
   struct proghdr ph;
-  pde_t *pgdir, *oldpgdir;
+  pde_t *pgdir;
+  struct vmspace *vm, *oldvm;
   struct proc *proc = myproc();
 
   begin_op();
@@ -28,6 +32,8 @@ exec(char *path, char **argv)
   }
   ilock(ip);
   pgdir = 0;
+  vm = 0;
+  oldvm = proc->vm;
 
   // Check ELF header
   if(readi(ip, (char*)&elf, 0, sizeof(elf)) != sizeof(elf))
@@ -35,28 +41,13 @@ exec(char *path, char **argv)
   if(elf.magic != ELF_MAGIC)
     goto bad;
 
-  if((pgdir = setupkvm()) == 0)
+  if((vm = vmalloc()) == 0 || (vm->pgdir = pgdir = setupkvm()) == 0)
     goto bad;
-  
-  //Clone all the meta-data of a zombie process and removing it from the proc structure
-  #ifndef NONE
-    for(int i=0;i < MAX_PSYC_PAGES; i++){
-      proc->free_pages[i].va = (char*)0xffffffff;
-      proc->free_pages[i].next = 0;
-      proc->free_pages[i].prev = 0;
-      proc->free_pages[i].age = 0;
-      proc->swap_space_pages[i].age = 0;
-      proc->swap_space_pages[i].va = (char*)0xffffffff;
-      proc->swap_space_pages[i].swaploc = 0;
-    }
 
-    proc->main_mem_pages = 0;
-    proc->swap_file_pages = 0;
-    proc->page_fault_count = 0;
-    proc->page_swapped_count = 0;
-    proc->head = 0;
-    proc->tail = 0;
-  #endif
+  // The new image goes into a fresh address space. Its pages are
+  // recorded in the paging bookkeeping of the current one, so make
+  // it current while they are allocated.
+  proc->vm = vm;
 
   // Load program into memory.
   sz = 0;
@@ -88,6 +79,11 @@ exec(char *path, char **argv)
   clearpteu(pgdir, (char*)(sz - 2*PGSIZE));
   sp = sz;
 
+  // The argument strings are still in the old image; switch back
+  // to it in case the scheduler loaded the new one meanwhile.
+  proc->vm = oldvm;
+  switchuvm(proc);
+
   // Push argument strings, prepare rest of stack in ustack.
   for(argc = 0; argv[argc]; argc++) {
     if(argc >= MAXARG)
@@ -113,26 +109,32 @@ exec(char *path, char **argv)
       last = s+1;
   safestrcpy(proc->name, last, sizeof(proc->name));
 
+  // Other threads go away with the old image.
+  if(killthreads() < 0)
+    goto bad;
+
   // Commit to the user image.
-  oldpgdir = proc->pgdir;
-  proc->pgdir = pgdir;
-  proc->sz = sz;
+  vm->sz = sz;
+  proc->vm = vm;
   proc->tf->eip = elf.entry;  // main
   proc->tf->esp = sp;
+  switchuvm(proc);
+  vmput(oldvm);
 
   #ifndef NONE
     if(proc->pid > 2){
-      createSwapFile(proc);
+      createSwapFile(vm, proc->pid);
     }
   #endif
 
-  switchuvm(proc);
-  freevm(oldpgdir);
   return 0;
 
   bad:
-    if(pgdir)
-      freevm(pgdir);
+    if(vm){
+      proc->vm = oldvm;
+      switchuvm(proc);
+      vmput(vm);
+    }
     if(ip){
       iunlockput(ip);
       end_op();
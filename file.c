@@ -10,16 +10,84 @@
 #include "sleeplock.h"
 #include "file.h"
 
+// Read-ahead window of a sequential reader, in blocks.
+#define RAMIN  4
+#define RAMAX  32
+
 struct devsw devsw[NDEV];
 struct {
-  struct spinlock lock;
-  struct file file[NFILE];
+  struct spinlock lock;    // protects ref counts
+  struct kmcache *cache;
+  struct kmcache *fdtcache;
 } ftable;
 
+static void
+fdtctor(void *obj)
+{
+  initlock(&((struct fdtable*)obj)->lock, "fdtable");
+}
+
 void
 fileinit(void)
 {
   initlock(&ftable.lock, "ftable");
+  if((ftable.cache = kmcache_create("file", sizeof(struct file), 0)) == 0 ||
+     (ftable.fdtcache = kmcache_create("fdtable", sizeof(struct fdtable), fdtctor)) == 0)
+    panic("fileinit");
+}
+
+// Allocate an open file table, empty if from is 0 and
+// otherwise holding a copy of every file open in from.
+struct fdtable*
+fdtalloc(struct fdtable *from)
+{
+  struct fdtable *fdt;
+  int fd;
+
+  if((fdt = kmcache_alloc(ftable.fdtcache)) == 0)
+    return 0;
+  fdt->ref = 1;
+  for(fd = 0; fd < NOFILE; fd++)
+    fdt->ofile[fd] = 0;
+  if(from){
+    acquire(&from->lock);
+    for(fd = 0; fd < NOFILE; fd++)
+      if(from->ofile[fd])
+        fdt->ofile[fd] = filedup(from->ofile[fd]);
+    release(&from->lock);
+  }
+  return fdt;
+}
+
+// Add a reference to fdt, for a new thread.
+struct fdtable*
+fdtdup(struct fdtable *fdt)
+{
+  acquire(&fdt->lock);
+  fdt->ref++;
+  release(&fdt->lock);
+  return fdt;
+}
+
+// Drop a reference to fdt, closing its files with the last one.
+void
+fdtput(struct fdtable *fdt)
+{
+  int fd;
+
+  acquire(&fdt->lock);
+  if(--fdt->ref > 0){
+    release(&fdt->lock);
+    return;
+  }
+  release(&fdt->lock);
+  for(fd = 0; fd < NOFILE; fd++){
+    if(fdt->ofile[fd]){
+      fileclose(fdt->ofile[fd]);
+      fdt->ofile[fd] = 0;
+    }
+  }
+  kmcache_free(ftable.fdtcache, fdt);
 }
 
 // Allocate a file structure.
@@ -28,16 +96,11 @@ filealloc(void)
 {
   struct file *f;
 
-  acquire(&ftable.lock);
-  for(f = ftable.file; f < ftable.file + NFILE; f++){
-    if(f->ref == 0){
-      f->ref = 1;
-      release(&ftable.lock);
-      return f;
-    }
-  }
-  release(&ftable.lock);
-  return 0;
+  if((f = kmcache_alloc(ftable.cache)) == 0)
+    return 0;
+  memset(f, 0, sizeof(*f));
+  f->ref = 1;
+  return f;
 }
 
 // Increment ref count for file f.
@@ -69,6 +132,7 @@ fileclose(struct file *f)
   f->ref = 0;
   f->type = FD_NONE;
   release(&ftable.lock);
+  kmcache_free(ftable.cache, f);
 
   if(ff.type == FD_PIPE)
     pipeclose(ff.pipe, ff.writable);
@@ -96,6 +160,7 @@ filestat(struct file *f, struct stat *st)
 int
 fileread(struct file *f, char *addr, int n)
 {
+  uint bn;
   int r;
 
   if(f->readable == 0)
@@ -104,8 +169,22 @@ fileread(struct file *f, char *addr, int n)
     return piperead(f->pipe, addr, n);
   if(f->type == FD_INODE){
     ilock(f->ip);
+    // Read ahead of a sequential reader, doubling the window
+    // for as long as the pattern holds.
+    if(f->off != f->ranext)
+      f->rawin = 0;
+    else if(f->rawin == 0)
+      f->rawin = RAMIN;
+    else if(f->rawin < RAMAX)
+      f->rawin *= 2;
     if((r = readi(f->ip, addr, f->off, n)) > 0)
       f->off += r;
+    f->ranext = f->off;
+    bn = f->off / BSIZE;
+    if(f->raend < bn)
+      f->raend = bn;
+    if(f->rawin && f->raend < bn + f->rawin)
+      f->raend = readahead(f->ip, f->raend, bn + f->rawin - f->raend);
     iunlock(f->ip);
     return r;
   }
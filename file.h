@@ -6,6 +6,16 @@ struct file {
   struct pipe *pipe;
   struct inode *ip;
   uint off;
+  uint ranext;  // off where a sequential read would start
+  uint rawin;   // read-ahead window in blocks; 0 if not sequential
+  uint raend;   // block after the last one read ahead
+};
+
+// Open file table, shared by the threads of a process.
+struct fdtable {
+  struct spinlock lock;   // protects ref and slot allocation
+  int ref;
+  struct file *ofile[NOFILE];
 };
 
 
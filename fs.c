@@ -17,6 +17,7 @@
 #include "proc.h"
 #include "spinlock.h"
 #include "sleeplock.h"
+#include "vmspace.h"
 #include "fs.h"
 #include "buf.h"
 #include "file.h"
@@ -44,7 +45,7 @@ bzero(int dev, int bno)
 {
   struct buf *bp;
 
-  bp = bread(dev, bno);
+  bp = boverwrite(dev, bno);
   memset(bp->data, 0, BSIZE);
   log_write(bp);
   brelse(bp);
@@ -484,6 +485,45 @@ readi(struct inode *ip, char *dst, uint off, uint n)
   return n;
 }
 
+// Return the disk block address of the nth block in inode ip,
+// or 0 if there is none. Unlike bmap, never allocates.
+static uint
+bmapped(struct inode *ip, uint bn)
+{
+  uint addr;
+  struct buf *bp;
+
+  if(bn < NDIRECT)
+    return ip->addrs[bn];
+  bn -= NDIRECT;
+  if(bn >= NINDIRECT || (addr = ip->addrs[NDIRECT]) == 0)
+    return 0;
+  bp = bread(ip->dev, addr);
+  addr = ((uint*)bp->data)[bn];
+  brelse(bp);
+  return addr;
+}
+
+// Start reading up to n blocks of ip, from block bn on, into
+// the buffer cache without waiting for them.
+// Return the block after the last one started.
+// Caller must hold ip->lock.
+uint
+readahead(struct inode *ip, uint bn, uint n)
+{
+  uint addr, nblocks;
+
+  if(ip->type == T_DEV)
+    return bn;
+  nblocks = (ip->size + BSIZE - 1) / BSIZE;
+  for(; n > 0 && bn < nblocks; n--, bn++){
+    if((addr = bmapped(ip, bn)) == 0)
+      break;
+    breadahead(ip->dev, addr);
+  }
+  return bn;
+}
+
 // PAGEBREAK!
 // Write data to inode.
 // Caller must hold ip->lock.
@@ -505,8 +545,11 @@ writei(struct inode *ip, char *src, uint off, uint n)
     return -1;
 
   for(tot=0; tot<n; tot+=m, off+=m, src+=m){
-    bp = bread(ip->dev, bmap(ip, off/BSIZE));
     m = min(n - tot, BSIZE - off%BSIZE);
+    if(m == BSIZE)  // whole block: no need to read it
+      bp = boverwrite(ip->dev, bmap(ip, off/BSIZE));
+    else
+      bp = bread(ip->dev, bmap(ip, off/BSIZE));
     memmove(bp->data + off%BSIZE, src, m);
     log_write(bp);
     brelse(bp);
@@ -708,22 +751,23 @@ char *itoa(int i, char b[])
   return b;
 }
 
-//remove swap file of proc p;
-int removeSwapFile(struct proc *p)
+//remove swap file of address space vm;
+int removeSwapFile(struct vmspace *vm)
 {
   //path of proccess
   char path[DIGITS];
   memmove(path, "/.swap", 6);
-  itoa(p->pid, path + 6);
+  itoa(vm->swapid, path + 6);
 
   struct inode *ip, *dp;
   struct dirent de;
   char name[DIRSIZ];
   uint off;
 
-  if (p->swapFile == 0)
+  if (vm->swapFile == 0)
     return -1;
-  fileclose(p->swapFile);
+  fileclose(vm->swapFile);
+  vm->swapFile = 0;
   begin_op();
   if ((dp = nameiparent(path, name)) == 0)
   {
@@ -773,47 +817,59 @@ bad:
   return -1;
 }
 
-//return 0 on success
-int createSwapFile(struct proc *p)
+//create the swap file of vm, named after pid;
+//return 0 on success, -1 if no inode or file is left
+int createSwapFile(struct vmspace *vm, int pid)
 {
 
   char path[DIGITS];
   memmove(path, "/.swap", 6);
-  itoa(p->pid, path + 6);
+  itoa(pid, path + 6);
+  vm->swapid = pid;
 
   begin_op();
   struct inode *in = create(path, T_FILE, 0, 0);
+  if (in == 0)
+  {
+    end_op();
+    vm->swapFile = 0;
+    return -1;
+  }
   iunlock(in);
 
-  p->swapFile = filealloc();
-  if (p->swapFile == 0)
-    panic("no slot for files on /store");
+  vm->swapFile = filealloc();
+  if (vm->swapFile == 0)
+  {
+    iput(in);
+    end_op();
+    return -1;
+  }
 
-  p->swapFile->ip = in;
-  p->swapFile->type = FD_INODE;
-  p->swapFile->off = 0;
-  p->swapFile->readable = O_WRONLY;
-  p->swapFile->writable = O_RDWR;
+  vm->swapFile->ip = in;
+  vm->swapFile->type = FD_INODE;
+  vm->swapFile->off = 0;
+  vm->swapFile->readable = O_WRONLY;
+  vm->swapFile->writable = O_RDWR;
   end_op();
 
   return 0;
 }
 
 //return as sys_write (-1 when error)
-int writeToSwapFile(struct proc *p, char *buffer, uint placeOnFile, uint size)
+int writeToSwapFile(struct vmspace *vm, char *buffer, uint placeOnFile, uint size)
 {
   int temp;
-  p->swapFile->off = placeOnFile;
+  vm->swapFile->off = placeOnFile;
   //cprintf("\ncalled\n");
-  temp = filewrite(p->swapFile, buffer, size);
+  temp = filewrite(vm->swapFile, buffer, size);
   //cprintf("temp = %d\n",temp);
   return temp;
 }
 
 //return as sys_read (-1 when error)
-int readFromSwapFile(struct proc *p, char *buffer, uint placeOnFile, uint size)
+int readFromSwapFile(struct vmspace *vm, char *buffer, uint placeOnFile, uint size)
 {
-  p->swapFile->off = placeOnFile;
+  vm->swapFile->off = placeOnFile;
 
-  return fileread(p->swapFile, buffer, size);
+  return fileread(vm->swapFile, buffer, size);
 }
\ No newline at end of file
@@ -1,4 +1,5 @@
-// Simple PIO-based (non-DMA) IDE driver code.
+// Simple IDE driver code. Transfers use the PIIX bus-master
+// DMA engine when there is one, and programmed I/O otherwise.
 
 #include "types.h"
 #include "defs.h"
@@ -12,6 +13,7 @@
 #include "sleeplock.h"
 #include "fs.h"
 #include "buf.h"
+#include "pci.h"
 
 #define SECTOR_SIZE   512
 #define IDE_BSY       0x80
@@ -23,16 +25,53 @@
 #define IDE_CMD_WRITE 0x30
 #define IDE_CMD_RDMUL 0xc4
 #define IDE_CMD_WRMUL 0xc5
+#define IDE_CMD_SETMULT 0xc6
+#define IDE_CMD_RDDMA 0xc8
+#define IDE_CMD_WRDMA 0xca
 
-// idequeue points to the buf now being read/written to the disk.
-// idequeue->qnext points to the next buf to be processed.
+#define IDE_MAXMULT   16  // most sectors per READ/WRITE MULTIPLE
+#define IDE_MAXDMA    64  // most sectors per DMA command
+
+// Bus-master IDE registers of the primary channel,
+// at an I/O base given by the controller's BAR4.
+#define BM_CMD        0
+#define BM_STATUS     2
+#define BM_PRDT       4
+#define BM_CMD_START  0x01
+#define BM_CMD_READ   0x08  // device to memory
+#define BM_ST_ERR     0x02
+#define BM_ST_INTR    0x04
+
+// Physical region descriptor: one contiguous piece of a DMA
+// transfer. It must not cross a 64 KB boundary.
+struct prd {
+  uint addr;
+  ushort len;
+  ushort flags;
+};
+#define PRD_EOT  0x8000  // last entry of the table
+
+// Requests are served in C-LOOK order: idequeue holds the
+// waiting bufs sorted by disk, then block, and the disk takes
+// the first one at or after (idedev, ideblock), where the last
+// command ended, wrapping around to the lowest when there is
+// none. A command covers a run of consecutive blocks of one
+// disk queued in the same direction, up to idemax sectors;
+// ideactive lists its bufs through qnext.
 // You must hold idelock while manipulating queue.
 
 static struct spinlock idelock;
 static struct buf *idequeue;
+static struct buf *ideactive;
+static uint idedev;
+static uint ideblock;
+static int idemult = 1;  // sectors per DRQ block in multiple mode
+static int idemax = 1;   // most sectors per command
+static ushort idebm;     // bus-master I/O base, 0 to use PIO
+static struct prd *ideprd;  // PRD table for the active command
 
 static int havedisk1;
-static void idestart(struct buf*);
+static void idestart(void);
 
 // Wait for IDE disk to become ready.
 static int
@@ -47,9 +86,22 @@ idewait(int checkerr)
   return 0;
 }
 
+// Put disk dev into multiple mode, IDE_MAXMULT sectors
+// per interrupt. Return 0 on success, -1 if unsupported.
+static int
+idesetmult(int dev)
+{
+  outb(0x1f6, 0xe0 | ((dev&1)<<4));
+  idewait(0);
+  outb(0x1f2, IDE_MAXMULT);
+  outb(0x1f7, IDE_CMD_SETMULT);
+  return idewait(1);
+}
+
 void
 ideinit(void)
 {
+  struct pcidev pci;
   int i;
 
   initlock(&idelock, "ide");
@@ -65,104 +117,235 @@ ideinit(void)
     }
   }
 
+  // Merge requests only if every disk takes multi-sector commands.
+  if(idesetmult(0) == 0 && (!havedisk1 || idesetmult(1) == 0))
+    idemult = IDE_MAXMULT;
+  idemax = idemult;
+
+  // Use DMA if the controller can be a bus master.
+  if(pcifind(&pci, PCI_ANY, PCI_ANY, 0x01, 0x01) == 0 && (pci.progif & 0x80) &&
+     (pci.bar[4] & PCI_BAR_IO) && (ideprd = (struct prd*)kalloc()) != 0){
+    pcienable(&pci);
+    idebm = PCI_BAR_IOADDR(pci.bar[4]);
+    idemax = IDE_MAXDMA;
+  }
+
   // Switch back to disk 0.
   outb(0x1f6, 0xe0 | (0<<4));
 }
 
-// Start the request for b.  Caller must hold idelock.
+// Does b come before block blockno of disk dev in C-LOOK order?
+static int
+idebefore(struct buf *b, uint dev, uint blockno)
+{
+  return b->dev < dev || (b->dev == dev && b->blockno < blockno);
+}
+
+// Insert b into idequeue, in block order.
 static void
-idestart(struct buf *b)
+ideinsert(struct buf *b)
 {
-  if(b == 0)
+  struct buf **pp;
+
+  for(pp=&idequeue; *pp && idebefore(*pp, b->dev, b->blockno); pp=&(*pp)->qnext)  //DOC:insert-queue
+    ;
+  b->qnext = *pp;
+  *pp = b;
+}
+
+// Fill the PRD table with the data of the bufs from b on.
+static void
+ideprdfill(struct buf *b)
+{
+  uint pa, n, left;
+  int i;
+
+  i = 0;
+  for(; b; b = b->qnext){
+    pa = V2P(b->data);
+    for(left = BSIZE; left > 0; left -= n, pa += n){
+      n = 0x10000 - (pa & 0xFFFF);
+      if(n > left)
+        n = left;
+      ideprd[i].addr = pa;
+      ideprd[i].len = n;
+      ideprd[i].flags = 0;
+      i++;
+    }
+  }
+  ideprd[i-1].flags = PRD_EOT;
+}
+
+// Start the next command: take the run of bufs at the C-LOOK
+// position from idequeue and issue one command for all of them.
+// Caller must hold idelock, and the disk must be idle.
+static void
+idestart(void)
+{
+  struct buf *b, *last, **pp, **start;
+  int n;
+
+  start = &idequeue;
+  for(pp = &idequeue; *pp; pp = &(*pp)->qnext){
+    if(!idebefore(*pp, idedev, ideblock)){
+      start = pp;
+      break;
+    }
+  }
+  if((b = *start) == 0)
     panic("idestart");
   if(b->blockno >= FSSIZE)
     panic("incorrect blockno");
   int sector_per_block =  BSIZE/SECTOR_SIZE;
   int sector = b->blockno * sector_per_block;
-  int read_cmd = (sector_per_block == 1) ? IDE_CMD_READ :  IDE_CMD_RDMUL;
-  int write_cmd = (sector_per_block == 1) ? IDE_CMD_WRITE : IDE_CMD_WRMUL;
 
   if (sector_per_block > 7) panic("idestart");
 
+  // Extend the run while the next queued buf is the next block
+  // of the same disk, going the same way, and fits in the command.
+  n = 1;
+  for(last = b; last->qnext && (n+1)*sector_per_block <= idemax; last = last->qnext, n++){
+    if(last->qnext->dev != b->dev ||
+       last->qnext->blockno != last->blockno + 1 ||
+       (last->qnext->flags & B_DIRTY) != (b->flags & B_DIRTY))
+      break;
+  }
+  *start = last->qnext;
+  last->qnext = 0;
+  ideactive = b;
+  idedev = last->dev;
+  ideblock = last->blockno + 1;
+
+  int nsect = n * sector_per_block;
+  int read_cmd = (nsect == 1) ? IDE_CMD_READ :  IDE_CMD_RDMUL;
+  int write_cmd = (nsect == 1) ? IDE_CMD_WRITE : IDE_CMD_WRMUL;
+
+  if(idebm){
+    // Point the bus master at the bufs, then start it
+    // once the disk has the command.
+    read_cmd = IDE_CMD_RDDMA;
+    write_cmd = IDE_CMD_WRDMA;
+    ideprdfill(b);
+    outb(idebm + BM_CMD, 0);
+    outl(idebm + BM_PRDT, V2P(ideprd));
+    outb(idebm + BM_STATUS, BM_ST_ERR|BM_ST_INTR);
+    outb(idebm + BM_CMD, (b->flags & B_DIRTY) ? 0 : BM_CMD_READ);
+  }
+
   idewait(0);
   outb(0x3f6, 0);  // generate interrupt
-  outb(0x1f2, sector_per_block);  // number of sectors
+  outb(0x1f2, nsect);  // number of sectors
   outb(0x1f3, sector & 0xff);
   outb(0x1f4, (sector >> 8) & 0xff);
   outb(0x1f5, (sector >> 16) & 0xff);
   outb(0x1f6, 0xe0 | ((b->dev&1)<<4) | ((sector>>24)&0x0f));
   if(b->flags & B_DIRTY){
     outb(0x1f7, write_cmd);
-    outsl(0x1f0, b->data, BSIZE/4);
+    for(; b && !idebm; b = b->qnext)
+      outsl(0x1f0, b->data, BSIZE/4);
   } else {
     outb(0x1f7, read_cmd);
   }
+  if(idebm)
+    outb(idebm + BM_CMD, inb(idebm + BM_CMD) | BM_CMD_START);
 }
 
 // Interrupt handler.
 void
 ideintr(void)
 {
-  struct buf *b;
+  struct buf *b, *next;
+  int ok, st;
 
-  // First queued buffer is the active request.
+  // ideactive lists the bufs of the finished command.
   acquire(&idelock);
 
-  if((b = idequeue) == 0){
+  if((b = ideactive) == 0){
     release(&idelock);
     return;
   }
-  idequeue = b->qnext;
+  ideactive = 0;
 
-  // Read data if needed.
-  if(!(b->flags & B_DIRTY) && idewait(1) >= 0)
-    insl(0x1f0, b->data, BSIZE/4);
+  if(idebm){
+    // The data is already in place. If the transfer failed,
+    // fall back to PIO and issue the command again.
+    st = inb(idebm + BM_STATUS);
+    outb(idebm + BM_CMD, 0);
+    outb(idebm + BM_STATUS, BM_ST_ERR|BM_ST_INTR);
+    if((st & BM_ST_ERR) || idewait(1) < 0){
+      cprintf("ide: DMA failed, using PIO\n");
+      idebm = 0;
+      idemax = idemult;
+      for(; b; b = next){
+        next = b->qnext;
+        ideinsert(b);
+      }
+      idestart();
+      release(&idelock);
+      return;
+    }
+    ok = 0;
+  } else {
+    // Read data if needed.
+    ok = !(b->flags & B_DIRTY) && idewait(1) >= 0;
+  }
+  for(; b; b = next){
+    next = b->qnext;
+    if(ok)
+      insl(0x1f0, b->data, BSIZE/4);
 
-  // Wake process waiting for this buf.
-  b->flags |= B_VALID;
-  b->flags &= ~B_DIRTY;
-  wakeup(b);
+    // Call the buf's completion function, or wake
+    // process waiting for it.
+    b->flags |= B_VALID;
+    b->flags &= ~B_DIRTY;
+    if(b->done)
+      b->done(b);
+    else
+      wakeup(b);
+  }
 
   // Start disk on next buf in queue.
   if(idequeue != 0)
-    idestart(idequeue);
+    idestart();
 
   release(&idelock);
 }
 
 //PAGEBREAK!
-// Sync buf with disk.
+// Queue b for the disk and return without waiting.
 // If B_DIRTY is set, write buf to disk, clear B_DIRTY, set B_VALID.
 // Else if B_VALID is not set, read buf from disk, set B_VALID.
+// When done, the interrupt handler calls b->done(b) if set, and
+// otherwise wakes ideawait().
 void
-iderw(struct buf *b)
+idesubmit(struct buf *b)
 {
-  struct buf **pp;
-
   if(!holdingsleep(&b->lock))
-    panic("iderw: buf not locked");
+    panic("idesubmit: buf not locked");
   if((b->flags & (B_VALID|B_DIRTY)) == B_VALID)
-    panic("iderw: nothing to do");
+    panic("idesubmit: nothing to do");
   if(b->dev != 0 && !havedisk1)
-    panic("iderw: ide disk 1 not present");
+    panic("idesubmit: ide disk 1 not present");
 
   acquire(&idelock);  //DOC:acquire-lock
 
-  // Append b to idequeue.
-  b->qnext = 0;
-  for(pp=&idequeue; *pp; pp=&(*pp)->qnext)  //DOC:insert-queue
-    ;
-  *pp = b;
+  ideinsert(b);
 
   // Start disk if necessary.
-  if(idequeue == b)
-    idestart(b);
+  if(ideactive == 0)
+    idestart();
+
+  release(&idelock);
+}
 
-  // Wait for request to finish.
+// Wait for the request for b, submitted without a
+// completion function, to finish.
+void
+ideawait(struct buf *b)
+{
+  acquire(&idelock);
   while((b->flags & (B_VALID|B_DIRTY)) != B_VALID){
     sleep(b, &idelock);
   }
-
-
   release(&idelock);
 }
@@ -1,6 +1,13 @@
 // Physical memory allocator, intended to allocate
 // memory for user processes, kernel stacks, page table pages,
 // and pipe buffers. Allocates 4096-byte pages.
+//
+// Free memory is kept by a buddy allocator, so runs of 2^order
+// physically contiguous pages can be allocated as well. A block
+// of order k starts at a page frame number that is a multiple of
+// 2^k; its buddy is the block whose pfn differs only in bit k.
+// Freeing a block merges it with its buddy while the buddy is
+// free too. kalloc() and kfree() handle single pages (order 0).
 
 #include "types.h"
 #include "defs.h"
@@ -16,12 +23,17 @@ extern char end[]; // first address after kernel loaded from ELF file
 
 struct run {
   struct run *next;
+  struct run *prev;
 };
 
+#define NPFN      (PHYSTOP/PGSIZE)
+#define PFN_FREE  0x80  // pfn starts a free block; low bits hold its order
+
 struct {
   struct spinlock lock;
   int use_lock;
-  struct run *freelist;
+  struct run *freelist[MAXORDER+1];
+  uchar state[NPFN];  // per page frame; PFN_FREE|order for free blocks
 } kmem;
 
 struct PageCounts free_page_counts;
@@ -57,49 +69,110 @@ freerange(void *vstart, void *vend)
   for(; p + PGSIZE <= (char*)vend; p += PGSIZE)
     kfree(p);
 }
+static void
+pushfree(struct run *r, int order)
+{
+  r->prev = 0;
+  r->next = kmem.freelist[order];
+  if(r->next)
+    r->next->prev = r;
+  kmem.freelist[order] = r;
+  kmem.state[V2P(r)/PGSIZE] = PFN_FREE | order;
+}
+
+static void
+unlinkfree(struct run *r, int order)
+{
+  if(r->prev)
+    r->prev->next = r->next;
+  else
+    kmem.freelist[order] = r->next;
+  if(r->next)
+    r->next->prev = r->prev;
+  kmem.state[V2P(r)/PGSIZE] = 0;
+}
+
 //PAGEBREAK: 21
-// Free the page of physical memory pointed at by v,
-// which normally should have been returned by a
-// call to kalloc().  (The exception is when
-// initializing the allocator; see kinit above.)
+// Free the 2^order contiguous pages of physical memory at v,
+// which normally should have been returned by a call to
+// kallocpages(order).  (The exception is when initializing
+// the allocator; see kinit above.)
 void
-kfree(char *v)
+kfreepages(char *v, int order)
 {
-  struct run *r;
+  uint pfn, buddy;
 
-  if((uint)v % PGSIZE || v < end || V2P(v) >= PHYSTOP)
+  if(order < 0 || order > MAXORDER || (uint)v % (PGSIZE << order) ||
+     v < end || V2P(v) + (PGSIZE << order) > PHYSTOP)
     panic("kfree");
 
   // Fill with junk to catch dangling refs.
-  memset(v, 1, PGSIZE);
+  memset(v, 1, PGSIZE << order);
 
   if(kmem.use_lock)
     acquire(&kmem.lock);
-  r = (struct run*)v;
-  r->next = kmem.freelist;
-  kmem.freelist = r;
-  free_page_counts.num_curr_free_pages++;
+  pfn = V2P(v) / PGSIZE;
+  if(kmem.state[pfn] & PFN_FREE)
+    panic("kfree: already free");
+  free_page_counts.num_curr_free_pages += 1 << order;
+  // Merge with the buddy for as long as it is free.
+  for(; order < MAXORDER; order++){
+    buddy = pfn ^ (1 << order);
+    if(buddy >= NPFN || kmem.state[buddy] != (PFN_FREE | order))
+      break;
+    unlinkfree((struct run*)P2V(buddy * PGSIZE), order);
+    pfn &= ~(1 << order);
+  }
+  pushfree((struct run*)P2V(pfn * PGSIZE), order);
   if(kmem.use_lock)
     release(&kmem.lock);
 }
 
-// Allocate one 4096-byte page of physical memory.
-// Returns a pointer that the kernel can use.
+// Allocate 2^order physically contiguous pages, aligned to
+// their size. Returns a pointer that the kernel can use.
 // Returns 0 if the memory cannot be allocated.
 char*
-kalloc(void)
+kallocpages(int order)
 {
   struct run *r;
+  int k;
 
+  if(order < 0 || order > MAXORDER)
+    return 0;
   if(kmem.use_lock)
     acquire(&kmem.lock);
-  r = kmem.freelist;
-  if(r) {
-    kmem.freelist = r->next;
-    free_page_counts.num_curr_free_pages--;
+  for(k = order; k <= MAXORDER && kmem.freelist[k] == 0; k++)
+    ;
+  r = 0;
+  if(k <= MAXORDER){
+    r = kmem.freelist[k];
+    unlinkfree(r, k);
+    // Split, returning the upper halves to the free lists.
+    while(k > order){
+      k--;
+      pushfree((struct run*)((char*)r + (PGSIZE << k)), k);
+    }
+    free_page_counts.num_curr_free_pages -= 1 << order;
   }
   if(kmem.use_lock)
     release(&kmem.lock);
   return (char*)r;
 }
 
+// Free the page of physical memory pointed at by v,
+// which normally should have been returned by a
+// call to kalloc().
+void
+kfree(char *v)
+{
+  kfreepages(v, 0);
+}
+
+// Allocate one 4096-byte page of physical memory.
+// Returns a pointer that the kernel can use.
+// Returns 0 if the memory cannot be allocated.
+char*
+kalloc(void)
+{
+  return kallocpages(0);
+}
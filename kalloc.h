@@ -2,6 +2,8 @@ struct PageCounts
 {
     uint num_init_free_pages;
     uint num_curr_free_pages;
+    uint reclaim_stalls;  // user allocations that found no free page
+    uint oom_kills;       // processes killed to free memory
 };
 
 extern struct PageCounts free_page_counts;
\ No newline at end of file
@@ -41,6 +41,8 @@
 #define TCCR    (0x0390/4)   // Timer Current Count
 #define TDCR    (0x03E0/4)   // Timer Divide Configuration
 
+#define TICKCOUNT  10000000    // timer counts per tick
+
 volatile uint *lapic;  // Initialized in mp.c
 
 //PAGEBREAK!
@@ -66,7 +68,7 @@ lapicinit(void)
   // TICR would be calibrated using an external time source.
   lapicw(TDCR, X1);
   lapicw(TIMER, PERIODIC | (T_IRQ0 + IRQ_TIMER));
-  lapicw(TICR, 10000000);
+  lapicw(TICR, TICKCOUNT);
 
   // Disable logical interrupt lines.
   lapicw(LINT0, MASKED);
@@ -105,6 +107,57 @@ lapicid(void)
   return lapic[ID] >> 24;
 }
 
+// Stop the periodic tick and interrupt once, n ticks from now,
+// instead; n == 0 stops the timer altogether.
+void
+lapiconeshot(uint n)
+{
+  if(!lapic)
+    return;
+  if(n > 0xFFFFFFFF / TICKCOUNT)
+    n = 0xFFFFFFFF / TICKCOUNT;
+  lapicw(TIMER, T_IRQ0 + IRQ_TIMER);
+  lapicw(TICR, n * TICKCOUNT);
+}
+
+// Timer counts short of a whole tick, per CPU, carried
+// from one tickless period to the next.
+static uint tickrem[NCPU];
+
+// Restart the periodic tick after lapiconeshot().
+// Return the number of whole ticks that passed meanwhile.
+uint
+lapicperiodic(void)
+{
+  uint n, elapsed, *rem;
+
+  if(!lapic)
+    return 0;
+  elapsed = lapic[TICR] - lapic[TCCR];
+  n = elapsed / TICKCOUNT;
+  rem = &tickrem[cpuid()];
+  *rem += elapsed % TICKCOUNT;
+  if(*rem >= TICKCOUNT){
+    *rem -= TICKCOUNT;
+    n++;
+  }
+  lapicw(TIMER, PERIODIC | (T_IRQ0 + IRQ_TIMER));
+  lapicw(TICR, TICKCOUNT);
+  return n;
+}
+
+// Send interrupt vector to the CPU with the given APIC ID.
+void
+lapicipi(int apicid, int vector)
+{
+  if(!lapic)
+    return;
+  lapicw(ICRHI, apicid<<24);
+  lapicw(ICRLO, FIXED | ASSERT | vector);
+  while(lapic[ICRLO] & DELIVS)
+    ;
+}
+
 // Acknowledge interrupt.
 void
 lapiceoi(void)
@@ -5,12 +5,13 @@
 #include "sleeplock.h"
 #include "fs.h"
 #include "buf.h"
+#include "timer.h"
 
 // Simple logging that allows concurrent FS system calls.
 //
 // A log transaction contains the updates of multiple FS system
-// calls. The logging system only commits when there are
-// no FS system calls active. Thus there is never
+// calls. A transaction is closed only when there are no FS
+// system calls active in it. Thus there is never
 // any reasoning required about whether a commit might
 // write an uncommitted system call's updates to disk.
 //
@@ -20,20 +21,40 @@
 // But if it thinks the log is close to running out, it
 // sleeps until the last outstanding end_op() commits.
 //
+// Transactions are double-buffered. The end_op() that leaves
+// the open transaction empty commits it: it copies the logged
+// blocks aside, which takes no disk I/O, and then lets the next
+// transaction open while it writes the copies to the log and
+// home. Ops that end while a commit is running join the next
+// one, so a busy file system commits in batches. If several
+// ops shared a transaction, the committer also holds it open
+// for up to COMMITTICKS, so that more ops can join it.
+//
+// Installing is deferred. A commit appends the transaction to
+// the on-disk log and leaves its blocks pinned in the cache;
+// only when the log has no room left for another transaction
+// does a checkpoint write the logged blocks home and empty
+// the log. A block logged by several of those transactions,
+// like a bitmap or inode block, is written home just once.
+//
 // The log is a physical re-do log containing disk blocks.
 // The on-disk log format:
 //   header block, containing block #s for block A, B, C, ...
+//     (a later entry for a block replaces an earlier one)
 //   block A
 //   block B
 //   block C
 //   ...
-// Log appends are synchronous.
+// Log appends are synchronous, but the blocks of one commit are
+// all queued for the disk before waiting for any of them.
+
+#define COMMITTICKS  2  // longest a committer waits for more ops
 
 // Contents of the header block, used for both the on-disk header block
 // and to keep track in memory of logged block# before commit.
 struct logheader {
   int n;
-  int block[LOGSIZE];
+  int block[NLOG-1];
 };
 
 struct log {
@@ -41,43 +62,103 @@ struct log {
   int start;
   int size;
   int outstanding; // how many FS sys calls are executing.
-  int committing;  // in commit(), please wait.
+  int nops;        // how many have joined the open transaction.
+  int closing;     // open transaction is being copied, please wait.
+  int committer;   // an end_op() will commit the open transaction.
+  int committing;  // in commit(), the next commit must wait.
+  int due;         // the commit timer went off.
   int dev;
-  struct logheader lh;
+  int committed;   // lh entries already in the on-disk log.
+  struct logheader tx;  // blocks of the open transaction
+  struct logheader lh;  // blocks in the log, as on disk
+  struct timer timer;
 };
 struct log log;
 
+// Copies of the logged blocks, taken when their transaction
+// closed; lbuf[i] holds the block of log slot i. They are
+// private to the log, not in the buffer cache, so the next
+// transaction can change the cached blocks while these go to
+// the log and home.
+static struct buf lbuf[NLOG-1];
+
 static void recover_from_log(void);
 static void commit();
+static void freeze(void);
+static void logtimeout(void*);
 
 void
 initlog(int dev)
 {
+  int i;
+
   if (sizeof(struct logheader) >= BSIZE)
     panic("initlog: too big logheader");
 
   struct superblock sb;
   initlock(&log.lock, "log");
+  log.timer.fn = logtimeout;
+  for (i = 0; i < NLOG-1; i++)
+    initsleeplock(&lbuf[i].lock, "lbuf");
   readsb(dev, &sb);
   log.start = sb.logstart;
   log.size = sb.nlog;
+  if (log.size > NLOG)
+    panic("initlog: log too big");
   log.dev = dev;
   recover_from_log();
 }
 
-// Copy committed blocks from log to their home location
+// Start a read of block blockno into lbuf[i], or a write of
+// lbuf[i] to it. Collect it with lbufwait(i).
+static void
+lbufsubmit(int i, uint blockno, int write)
+{
+  struct buf *b = &lbuf[i];
+
+  acquiresleep(&b->lock);
+  b->dev = log.dev;
+  b->blockno = blockno;
+  b->flags = write ? B_DIRTY : 0;
+  bsubmit(b);
+}
+
+// Wait for the I/O started on lbuf[i].
+static void
+lbufwait(int i)
+{
+  bwait(&lbuf[i]);
+  releasesleep(&lbuf[i].lock);
+}
+
+// Does a later log slot hold the same block as slot i?
+static int
+superseded(int i)
+{
+  int j;
+
+  for (j = i+1; j < log.lh.n; j++) {
+    if (log.lh.block[j] == log.lh.block[i])
+      return 1;
+  }
+  return 0;
+}
+
+// Copy committed blocks from lbuf to their home location,
+// only the latest copy of each. All the writes are queued
+// before waiting for any.
 static void
 install_trans(void)
 {
   int tail;
 
   for (tail = 0; tail < log.lh.n; tail++) {
-    struct buf *lbuf = bread(log.dev, log.start+tail+1); // read log block
-    struct buf *dbuf = bread(log.dev, log.lh.block[tail]); // read dst
-    memmove(dbuf->data, lbuf->data, BSIZE);  // copy block to dst
-    bwrite(dbuf);  // write dst to disk
-    brelse(lbuf);
-    brelse(dbuf);
+    if (!superseded(tail))
+      lbufsubmit(tail, log.lh.block[tail], 1);  // write dst to disk
+  }
+  for (tail = 0; tail < log.lh.n; tail++) {
+    if (!superseded(tail))
+      lbufwait(tail);
   }
 }
 
@@ -101,9 +182,10 @@ read_head(void)
 static void
 write_head(void)
 {
-  struct buf *buf = bread(log.dev, log.start);
+  struct buf *buf = boverwrite(log.dev, log.start);
   struct logheader *hb = (struct logheader *) (buf->data);
   int i;
+  memset(buf->data, 0, BSIZE);
   hb->n = log.lh.n;
   for (i = 0; i < log.lh.n; i++) {
     hb->block[i] = log.lh.block[i];
@@ -112,10 +194,23 @@ write_head(void)
   brelse(buf);
 }
 
+// Read the logged blocks into lbuf.
+static void
+read_log(void)
+{
+  int tail;
+
+  for (tail = 0; tail < log.lh.n; tail++)
+    lbufsubmit(tail, log.start+tail+1, 0);
+  for (tail = 0; tail < log.lh.n; tail++)
+    lbufwait(tail);
+}
+
 static void
 recover_from_log(void)
 {
   read_head();
+  read_log();
   install_trans(); // if committed, copy from log to disk
   log.lh.n = 0;
   write_head(); // clear the log
@@ -127,77 +222,165 @@ begin_op(void)
 {
   acquire(&log.lock);
   while(1){
-    if(log.committing){
+    if(log.closing){
       sleep(&log, &log.lock);
-    } else if(log.lh.n + (log.outstanding+1)*MAXOPBLOCKS > LOGSIZE){
+    } else if(log.tx.n + (log.outstanding+1)*MAXOPBLOCKS > LOGSIZE){
       // this op might exhaust log space; wait for commit.
       sleep(&log, &log.lock);
     } else {
       log.outstanding += 1;
+      log.nops += 1;
       release(&log.lock);
       break;
     }
   }
 }
 
+// Run by the commit timer.
+static void
+logtimeout(void *arg)
+{
+  acquire(&log.lock);
+  log.due = 1;
+  wakeup(&log);
+  release(&log.lock);
+}
+
 // called at the end of each FS system call.
 // commits if this was the last outstanding operation.
 void
 end_op(void)
 {
-  int do_commit = 0;
+  int i;
 
   acquire(&log.lock);
   log.outstanding -= 1;
-  if(log.committing)
-    panic("log.committing");
-  if(log.outstanding == 0){
-    do_commit = 1;
-    log.committing = 1;
-  } else {
-    // begin_op() may be waiting for log space,
-    // and decrementing log.outstanding has decreased
-    // the amount of reserved space.
-    wakeup(&log);
+  // begin_op() may be waiting for log space, and decrementing
+  // log.outstanding has decreased the amount of reserved space.
+  // A committer may be waiting for the last op to end.
+  wakeup(&log);
+  if(log.outstanding > 0 || log.committer || log.tx.n == 0){
+    release(&log.lock);
+    return;
   }
-  release(&log.lock);
 
-  if(do_commit){
-    // call commit w/o holding locks, since not allowed
-    // to sleep with locks.
-    commit();
-    acquire(&log.lock);
-    log.committing = 0;
-    wakeup(&log);
+  // Become the committer. Arm the timer without holding
+  // log.lock, which logtimeout() takes with tickslock held.
+  log.committer = 1;
+  log.due = log.nops < 2;
+  if(!log.due){
     release(&log.lock);
+    timersync();
+    acquire(&tickslock);
+    timeradd(&log.timer, ticks + COMMITTICKS);
+    release(&tickslock);
+    acquire(&log.lock);
+  }
+
+  // Meanwhile new ops may join the transaction. Close it
+  // once they are done, the previous commit is finished, and
+  // the timer went off or another op might not fit.
+  while(log.outstanding > 0 || log.committing ||
+        (!log.due && log.tx.n + MAXOPBLOCKS <= LOGSIZE))
+    sleep(&log, &log.lock);
+  log.committer = 0;
+  log.closing = 1;
+  for (i = 0; i < log.tx.n; i++)
+    log.lh.block[log.lh.n + i] = log.tx.block[i];
+  log.lh.n += log.tx.n;
+  log.tx.n = 0;
+  log.nops = 0;
+  release(&log.lock);
+
+  // Copy the blocks out before the next transaction can
+  // change them.
+  freeze();
+
+  acquire(&log.lock);
+  log.closing = 0;
+  log.committing = 1;
+  wakeup(&log);
+  release(&log.lock);
+
+  // call commit w/o holding locks, since not allowed
+  // to sleep with locks.
+  commit();
+  acquire(&log.lock);
+  log.committing = 0;
+  wakeup(&log);
+  release(&log.lock);
+}
+
+// Copy the newly logged blocks from cache to lbuf.
+static void
+freeze(void)
+{
+  struct buf *from;
+  int tail;
+
+  for (tail = log.committed; tail < log.lh.n; tail++) {
+    from = bread(log.dev, log.lh.block[tail]); // cache block
+    memmove(lbuf[tail].data, from->data, BSIZE);
+    brelse(from);
   }
 }
 
-// Copy modified blocks from cache to log.
+// Append the new copies in lbuf to the log.
 static void
 write_log(void)
 {
   int tail;
 
+  for (tail = log.committed; tail < log.lh.n; tail++)
+    lbufsubmit(tail, log.start+tail+1, 1);  // write the log
+  for (tail = log.committed; tail < log.lh.n; tail++)
+    lbufwait(tail);
+}
+
+// Let the cache evict the installed blocks again, except the
+// ones the open transaction has logged since.
+static void
+unpin(void)
+{
+  struct buf *b;
+  int tail, i;
+
   for (tail = 0; tail < log.lh.n; tail++) {
-    struct buf *to = bread(log.dev, log.start+tail+1); // log block
-    struct buf *from = bread(log.dev, log.lh.block[tail]); // cache block
-    memmove(to->data, from->data, BSIZE);
-    bwrite(to);  // write the log
-    brelse(from);
-    brelse(to);
+    if (superseded(tail))
+      continue;
+    b = bread(log.dev, log.lh.block[tail]);
+    acquire(&log.lock);
+    for (i = 0; i < log.tx.n; i++) {
+      if (log.tx.block[i] == b->blockno)
+        break;
+    }
+    if (i == log.tx.n)
+      b->flags &= ~B_DIRTY;
+    release(&log.lock);
+    brelse(b);
   }
 }
 
+// Write the logged blocks home and empty the log.
+static void
+checkpoint(void)
+{
+  install_trans(); // Install writes to home locations
+  unpin();
+  log.lh.n = 0;
+  log.committed = 0;
+  write_head();    // Erase the transactions from the log
+}
+
 static void
 commit()
 {
-  if (log.lh.n > 0) {
-    write_log();     // Write modified blocks from cache to log
+  if (log.lh.n > log.committed) {
+    write_log();     // Write the copied blocks to log
     write_head();    // Write header to disk -- the real commit
-    install_trans(); // Now install writes to home locations
-    log.lh.n = 0;
-    write_head();    // Erase the transaction from the log
+    log.committed = log.lh.n;
+    if (log.lh.n + LOGSIZE > log.size - 1)
+      checkpoint();  // No room for another transaction
   }
 }
 
@@ -215,19 +398,19 @@ log_write(struct buf *b)
 {
   int i;
 
-  if (log.lh.n >= LOGSIZE || log.lh.n >= log.size - 1)
+  if (log.tx.n >= LOGSIZE || log.tx.n >= log.size - 1)
     panic("too big a transaction");
   if (log.outstanding < 1)
     panic("log_write outside of trans");
 
   acquire(&log.lock);
-  for (i = 0; i < log.lh.n; i++) {
-    if (log.lh.block[i] == b->blockno)   // log absorbtion
+  for (i = 0; i < log.tx.n; i++) {
+    if (log.tx.block[i] == b->blockno)   // log absorbtion
       break;
   }
-  log.lh.block[i] = b->blockno;
-  if (i == log.lh.n)
-    log.lh.n++;
+  log.tx.block[i] = b->blockno;
+  if (i == log.tx.n)
+    log.tx.n++;
   b->flags |= B_DIRTY; // prevent eviction
   release(&log.lock);
 }
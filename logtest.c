@@ -0,0 +1,90 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "fcntl.h"
+
+#define NCHILD  4
+#define NWRITE  200
+#define WSIZE   16
+
+// Each child appends to its own file in small writes, so the
+// children's ops keep sharing transactions; then the parent
+// reads every file back.
+void
+writer(int id)
+{
+  char name[] = "logtest0.tmp";
+  char buf[WSIZE];
+  int fd, i;
+
+  name[7] = '0' + id;
+  if((fd = open(name, O_CREATE|O_RDWR)) < 0){
+    printf(1, "child %d: open failed\n", id);
+    exit();
+  }
+  for(i = 0; i < NWRITE; i++){
+    memset(buf, 'a' + (id + i) % 26, WSIZE);
+    if(write(fd, buf, WSIZE) != WSIZE){
+      printf(1, "child %d: write failed\n", id);
+      exit();
+    }
+  }
+  close(fd);
+  exit();
+}
+
+int
+check(int id)
+{
+  char name[] = "logtest0.tmp";
+  char buf[WSIZE];
+  int fd, i, j;
+
+  name[7] = '0' + id;
+  if((fd = open(name, O_RDONLY)) < 0)
+    return -1;
+  for(i = 0; i < NWRITE; i++){
+    if(read(fd, buf, WSIZE) != WSIZE)
+      break;
+    for(j = 0; j < WSIZE; j++)
+      if(buf[j] != 'a' + (id + i) % 26)
+        break;
+    if(j < WSIZE)
+      break;
+  }
+  close(fd);
+  unlink(name);
+  return i == NWRITE ? 0 : -1;
+}
+
+int
+main(int argc, char *argv[])
+{
+  int i, start;
+
+  printf(1, "\n   ***Testing group commit***\n");
+
+  start = uptime();
+  for(i = 0; i < NCHILD; i++){
+    int pid = fork();
+    if(pid < 0){
+      printf(1, "fork failed\n");
+      exit();
+    }
+    if(pid == 0)
+      writer(i);
+  }
+  for(i = 0; i < NCHILD; i++)
+    wait();
+  printf(1, "%d writers, %d small writes each: %d ticks\n",
+         NCHILD, NWRITE, uptime() - start);
+
+  for(i = 0; i < NCHILD; i++){
+    if(check(i) < 0){
+      printf(1, "file %d has the wrong contents\n", i);
+      exit();
+    }
+  }
+  printf(1, "concurrent writers: ok\n");
+  exit();
+}
@@ -0,0 +1,59 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "mman.h"
+
+#define PAGESIZE 4096
+#define NPAGES   24
+
+// Touch more pages than fit in memory with a few of them locked,
+// stream through the rest sequentially, then drop them.
+int
+main(int argc, char *argv[])
+{
+  char *mem;
+  int i;
+
+  printf(1, "\n   ***Testing mlock/madvise***\n");
+
+  mem = sbrk(NPAGES*PAGESIZE);
+  if(mlock(mem, 4*PAGESIZE) < 0){
+    printf(1, "mlock failed\n");
+    exit();
+  }
+  if(mlock(mem, NPAGES*PAGESIZE) == 0){
+    printf(1, "mlock accepted more pages than fit in memory\n");
+    exit();
+  }
+  if(madvise(mem + 4*PAGESIZE, (NPAGES-4)*PAGESIZE, MADV_SEQUENTIAL) < 0){
+    printf(1, "madvise(MADV_SEQUENTIAL) failed\n");
+    exit();
+  }
+
+  for(i = 0; i < NPAGES; i++)
+    mem[i*PAGESIZE] = i;
+  for(i = 0; i < NPAGES; i++){
+    if(mem[i*PAGESIZE] != i){
+      printf(1, "page %d lost its contents\n", i);
+      exit();
+    }
+  }
+
+  if(madvise(mem, NPAGES*PAGESIZE, MADV_DONTNEED) == 0){
+    printf(1, "madvise(MADV_DONTNEED) dropped locked pages\n");
+    exit();
+  }
+  munlock(mem, 4*PAGESIZE);
+  if(madvise(mem, NPAGES*PAGESIZE, MADV_DONTNEED) < 0){
+    printf(1, "madvise(MADV_DONTNEED) failed\n");
+    exit();
+  }
+  for(i = 0; i < NPAGES; i++){
+    if(mem[i*PAGESIZE] != 0){
+      printf(1, "page %d not zero after MADV_DONTNEED\n", i);
+      exit();
+    }
+  }
+  printf(1, "mlock/madvise: ok\n");
+  exit();
+}
@@ -0,0 +1,4 @@
+#define MADV_NORMAL      0  // no special treatment
+#define MADV_SEQUENTIAL  2  // read ahead, evict pages behind
+#define MADV_WILLNEED    3  // page in now
+#define MADV_DONTNEED    4  // drop contents; reads back as zero
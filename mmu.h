@@ -96,6 +96,7 @@ struct segdesc {
 #define PTE_U           0x004   // User
 #define PTE_PS          0x080   // Page Size
 #define PTE_PG          0x200   // Paged out
+#define PTE_SHM         0x400   // Shared-memory page
 #define PTE_A           0x020   // Accessed
 
 // Address in page table or page directory entry
@@ -103,7 +104,6 @@ struct segdesc {
 #define PTE_FLAGS(pte)  ((uint)(pte) &  0xFFF)
 
 #ifndef __ASSEMBLER__
-typedef uint pte_t;
 
 // Task state segment format
 struct taskstate {
@@ -0,0 +1,31 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+
+#define PAGESIZE 4096
+
+// Grow the heap until sbrk() fails. With a swap file the process
+// runs out of swap slots first and must get an error back, not
+// bring down the kernel; the pages it has must stay intact.
+int
+main(int argc, char *argv[])
+{
+  char *start, *p;
+  int i, n;
+
+  printf(1, "\n   ***Testing memory exhaustion***\n");
+
+  start = sbrk(0);
+  for(n = 0; (p = sbrk(PAGESIZE)) != (char*)-1; n++)
+    *p = n;
+  printf(1, "sbrk failed after %d pages\n", n);
+
+  for(i = 0; i < n; i++){
+    if(start[i*PAGESIZE] != (char)i){
+      printf(1, "page %d lost its contents\n", i);
+      exit();
+    }
+  }
+  printf(1, "memory exhaustion: ok\n");
+  exit();
+}
@@ -1,14 +1,19 @@
-#define NPROC        64  // maximum number of processes
 #define KSTACKSIZE 4096  // size of per-process kernel stack
 #define NCPU          8  // maximum number of CPUs
 #define NOFILE       16  // open files per process
-#define NFILE       100  // open files per system
 #define NINODE       50  // maximum number of active i-nodes
 #define NDEV         10  // maximum major device number
 #define ROOTDEV       1  // device number of file system root disk
 #define MAXARG       32  // max exec arguments
 #define MAXOPBLOCKS  10  // max # of blocks any FS op writes
-#define LOGSIZE      (MAXOPBLOCKS*3)  // max data blocks in on-disk log
-#define NBUF         (MAXOPBLOCKS*3)  // size of disk block cache
-#define FSSIZE       1000  // size of file system in blocks
+#define LOGSIZE      (MAXOPBLOCKS*3)  // max data blocks in one transaction
+#define NLOG         (LOGSIZE*2+1)  // on-disk log blocks, header included
+#define NBUF         (LOGSIZE*3+MAXOPBLOCKS)  // static disk block cache buffers
+#define BCACHEFRAC    8  // block cache grows to 1/BCACHEFRAC of memory
+#define FSSIZE       2000  // size of file system in blocks
+#define MAXORDER     10  // largest kallocpages() block is 2^MAXORDER pages
+#define OOM_RETRIES  8  // yields to an OOM victim before an allocation fails
+#define MAXPID    32767  // pids wrap around after this
+#define NSHM         16  // maximum number of shared-memory segments
+#define SHMMAXPAGES  256  // maximum pages in a shared-memory segment
 
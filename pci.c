@@ -0,0 +1,88 @@
+// PCI configuration space, through configuration mechanism #1
+// (I/O ports 0xCF8 and 0xCFC), as emulated by QEMU.
+// Drivers use pcifind() to locate their device and its
+// registers; there is no hot plug and no PCI-to-PCI bridge
+// handling beyond scanning every bus number.
+
+#include "types.h"
+#include "defs.h"
+#include "x86.h"
+#include "pci.h"
+
+#define PCI_ADDR  0xCF8
+#define PCI_DATA  0xCFC
+
+#define NPCIBUS   256
+#define NPCIDEV   32
+#define NPCIFUNC  8
+
+uint
+pciread(struct pcidev *d, int off)
+{
+  outl(PCI_ADDR, 0x80000000 | d->bus<<16 | d->dev<<11 | d->func<<8 | (off & 0xFC));
+  return inl(PCI_DATA);
+}
+
+void
+pciwrite(struct pcidev *d, int off, uint val)
+{
+  outl(PCI_ADDR, 0x80000000 | d->bus<<16 | d->dev<<11 | d->func<<8 | (off & 0xFC));
+  outl(PCI_DATA, val);
+}
+
+// Fill in d, whose bus, dev and func are set, from its
+// configuration header. Return -1 if there is no such function.
+static int
+pciprobe(struct pcidev *d)
+{
+  uint id, class;
+  int i;
+
+  id = pciread(d, PCI_ID);
+  if((id & 0xFFFF) == 0xFFFF)
+    return -1;
+  d->vendor = id & 0xFFFF;
+  d->device = id >> 16;
+  class = pciread(d, PCI_CLASS);
+  d->class = class >> 24;
+  d->subclass = class >> 16;
+  d->progif = class >> 8;
+  d->irq = pciread(d, PCI_INTR);
+  for(i = 0; i < 6; i++)
+    d->bar[i] = pciread(d, PCI_BAR0 + 4*i);
+  return 0;
+}
+
+// Find the first PCI function with the given vendor and device
+// ids, or class and subclass; PCI_ANY matches anything. Fill in
+// d and return 0, or return -1 if there is none.
+int
+pcifind(struct pcidev *d, int vendor, int device, int class, int subclass)
+{
+  int nfunc;
+
+  for(d->bus = 0; d->bus < NPCIBUS; d->bus++){
+    for(d->dev = 0; d->dev < NPCIDEV; d->dev++){
+      nfunc = 1;
+      for(d->func = 0; d->func < nfunc; d->func++){
+        if(pciprobe(d) < 0)
+          continue;
+        if(d->func == 0 && (pciread(d, PCI_HEADER) & 0x800000))
+          nfunc = NPCIFUNC;  // multi-function device
+        if((vendor == PCI_ANY || d->vendor == vendor) &&
+           (device == PCI_ANY || d->device == device) &&
+           (class == PCI_ANY || d->class == class) &&
+           (subclass == PCI_ANY || d->subclass == subclass))
+          return 0;
+      }
+    }
+  }
+  return -1;
+}
+
+// Let d respond to I/O accesses and act as a bus master.
+void
+pcienable(struct pcidev *d)
+{
+  pciwrite(d, PCI_COMMAND, pciread(d, PCI_COMMAND) | PCI_CMD_IO | PCI_CMD_MEM | PCI_CMD_MASTER);
+}
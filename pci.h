@@ -0,0 +1,33 @@
+// PCI device, as found by pcifind().
+struct pcidev {
+  int bus;
+  int dev;
+  int func;
+  ushort vendor;
+  ushort device;
+  uchar class;
+  uchar subclass;
+  uchar progif;
+  uchar irq;         // interrupt line
+  uint bar[6];       // base address registers, as read
+};
+
+// Configuration space registers
+#define PCI_ID        0x00  // vendor, device
+#define PCI_COMMAND   0x04
+#define PCI_CLASS     0x08  // revision, prog-if, subclass, class
+#define PCI_HEADER    0x0C  // header type in bits 16-23
+#define PCI_BAR0      0x10
+#define PCI_INTR      0x3C  // interrupt line in bits 0-7
+
+// PCI_COMMAND bits
+#define PCI_CMD_IO      0x1   // respond to I/O space accesses
+#define PCI_CMD_MEM     0x2   // respond to memory space accesses
+#define PCI_CMD_MASTER  0x4   // may act as bus master (DMA)
+
+// An I/O-space BAR has bit 0 set; its port is in the rest.
+#define PCI_BAR_IO      0x1
+#define PCI_BAR_IOADDR(bar)  ((bar) & ~0x3)
+
+// Wildcard for pcifind()
+#define PCI_ANY  -1
@@ -9,47 +9,130 @@
 #include "fs.h"
 #include "file.h"
 #include "proc.h"
+#include "vmspace.h"
 #include "kalloc.h"
+#include "timer.h"
+#include "traps.h"
+#include "cpustat.h"
+#include "pstat.h"
+#include "bcstat.h"
+
+// Process structures come from a slab cache, so the number of
+// processes is bounded only by memory. ptable.lock protects
+// process lifecycle: allocation, the list of all processes,
+// the pid hash, parent and child links, exit and wait.
+// Threads made by clone() are processes that share a vmspace
+// and an fdtable; vmcache holds the vmspaces.
+#define NPIDHASH 64
 
 struct {
   struct spinlock lock;
-  struct proc proc[NPROC];
+  struct kmcache *cache;
+  struct kmcache *vmcache;
+  struct proc *all;
+  struct proc *pidhash[NPIDHASH];
 } ptable;
 
+// Each CPU runs processes from its own queue of RUNNABLE processes
+// and steals from the others when it runs dry. A queue's lock
+// guards its list and the state of the processes on it, and is
+// what a process holds across the switch into the scheduler:
+// whoever makes p RUNNABLE takes runqs[p->cpu].lock, which the
+// CPU it last ran on holds until p's context has been saved.
+// With SCHEDULER=MLFQ each queue has a list per priority level.
+//
+// A process keeps to the CPU it last ran on, whose caches are
+// warm with its data, and only moves when another CPU goes idle
+// and steals it. p->affinity pins it to a set of CPUs: it is only
+// queued on, and stolen by, CPUs in the set.
+struct runq {
+  struct spinlock lock;
+  struct proc *head[NPRIO];
+  struct proc *tail[NPRIO];
+  int len;
+#if MLFQ
+  uint epoch;             // boostepoch its levels were last merged in
+#endif
+};
+
+static struct runq runqs[NCPU];
+
+#if MLFQ
+// Bumped every BOOSTTICKS; processes and queues notice lazily.
+static uint boostepoch;
+static struct timer boosttimer;
+
+static void
+boost(void *arg)
+{
+  boostepoch++;
+  timeradd(&boosttimer, ticks + BOOSTTICKS);
+}
+#endif
+
+// Sleeping processes wait on a hash table of queues keyed by
+// channel, so wakeup() only looks at the waiters that may be on
+// its channel. A bucket's lock guards its list and the chan and
+// SLEEPING state of the processes on it.
+// Lock order: the caller's lock (ptable.lock, for wait and exit),
+// then a wait queue lock, then a run queue lock.
+#define NWAITQ 64
+
+struct waitq {
+  struct spinlock lock;
+  struct proc *head;
+};
+
+static struct waitq waitqs[NWAITQ];
+
+static struct waitq*
+chanwaitq(void *chan)
+{
+  return &waitqs[((uint)chan * 2654435761U) >> 26];
+}
+
 static struct proc *initproc;
 
 int nextpid = 1;
 extern void forkret(void);
 extern void trapret(void);
 
-static void wakeup1(void *chan);
+static void wakeproc(struct proc*);
+static void requeue(void);
 
+
+// Age the resident pages by n ticks; accessed ones start over.
 void 
-updateNFUState(){
+updateNFUState(uint n){
 
   struct proc *p;
+  struct vmspace *vm;
   int i;
   pte_t *pte, *pde;
 
   acquire(&ptable.lock);
-  for(p = ptable.proc; p< &ptable.proc[NPROC]; p++){
+  for(p = ptable.all; p; p = p->allnext){
     if((p->state == RUNNING || p->state == RUNNABLE || p->state == SLEEPING)){
+      // Age each address space once, not once per thread.
+      if((vm = p->vm) == 0 || vm->pgdir == 0 || vm->agetick == ticks)
+        continue;
+      vm->agetick = ticks;
       for(i=0; i<MAX_PSYC_PAGES; i++){
-        if(p->free_pages[i].va == (char*)0xffffffff)
+        if(vm->free_pages[i].va == (char*)0xffffffff)
           continue;
-        p->free_pages[i].age++;
-        p->swap_space_pages[i].age++;
+        vm->free_pages[i].age += n;
+        vm->swap_space_pages[i].age += n;
 
-        pde = &p->pgdir[PDX(p->free_pages[i].va)];
+        pde = &vm->pgdir[PDX(vm->free_pages[i].va)];
         if(*pde & PTE_P){
           pte_t *pgtab;
           pgtab = (pte_t*)P2V(PTE_ADDR(*pde));
-          pte = &pgtab[PTX(p->free_pages[i].va)];
+          pte = &pgtab[PTX(vm->free_pages[i].va)];
         }
         else pte = 0;
         if(pte){
           if(*pte & PTE_A){
-            p->free_pages[i].age = 0;
+            vm->free_pages[i].age = 0;
           }
         }
       }
@@ -57,10 +140,26 @@ updateNFUState(){
   }
   release(&ptable.lock);
 }
+
+static void
+vmctor(void *obj)
+{
+  initsleeplock(&((struct vmspace*)obj)->lock, "vmspace");
+}
+
 void
 pinit(void)
 {
+  int i;
+
   initlock(&ptable.lock, "ptable");
+  if((ptable.cache = kmcache_create("proc", sizeof(struct proc), 0)) == 0 ||
+     (ptable.vmcache = kmcache_create("vmspace", sizeof(struct vmspace), vmctor)) == 0)
+    panic("pinit");
+  for(i = 0; i < NCPU; i++)
+    initlock(&runqs[i].lock, "runq");
+  for(i = 0; i < NWAITQ; i++)
+    initlock(&waitqs[i].lock, "waitq");
 }
 
 // Must be called with interrupts disabled
@@ -102,6 +201,230 @@ myproc(void) {
   return p;
 }
 
+// Append p to rq at its priority level.
+// Caller must hold rq->lock.
+static void
+enqueue(struct runq *rq, struct proc *p)
+{
+  int l;
+
+#if MLFQ
+  if(p->epoch != boostepoch){
+    p->epoch = boostepoch;
+    p->prio = p->base_prio;
+    p->slice = 0;
+  }
+#endif
+  l = p->prio;
+  p->rqnext = 0;
+  if(rq->tail[l])
+    rq->tail[l]->rqnext = p;
+  else
+    rq->head[l] = p;
+  rq->tail[l] = p;
+  rq->len++;
+}
+
+#if MLFQ
+// After a boost, move everything queued on rq back to its
+// top level. Caller must hold rq->lock.
+static void
+boostrunq(struct runq *rq)
+{
+  struct proc *p, *next;
+  int l;
+
+  rq->epoch = boostepoch;
+  for(l = 1; l < NPRIO; l++){
+    p = rq->head[l];
+    rq->head[l] = rq->tail[l] = 0;
+    for(; p; p = next){
+      next = p->rqnext;
+      rq->len--;
+      enqueue(rq, p);
+    }
+  }
+}
+#endif
+
+// Remove and return the first process of the highest level
+// of rq whose affinity shares a CPU with mask, or 0.
+// Caller must hold rq->lock.
+static struct proc*
+dequeue(struct runq *rq, uint mask)
+{
+  struct proc *p, *prev;
+  int l;
+
+#if MLFQ
+  if(rq->epoch != boostepoch)
+    boostrunq(rq);
+#endif
+  for(l = 0; l < NPRIO; l++){
+    prev = 0;
+    for(p = rq->head[l]; p; prev = p, p = p->rqnext)
+      if(p->affinity & mask)
+        break;
+    if(p == 0)
+      continue;
+    if(prev)
+      prev->rqnext = p->rqnext;
+    else
+      rq->head[l] = p->rqnext;
+    if(rq->tail[l] == p)
+      rq->tail[l] = prev;
+    p->rqnext = 0;
+    rq->len--;
+    return p;
+  }
+  return 0;
+}
+
+// Lock and return the current CPU's run queue.
+static struct runq*
+lockmyrunq(void)
+{
+  struct runq *rq;
+
+  pushcli();
+  rq = &runqs[cpuid()];
+  acquire(&rq->lock);
+  popcli();
+  return rq;
+}
+
+// Release the run queue lock held across sched(), which
+// belongs to the CPU the process has been resumed on.
+static void
+unlockmyrunq(void)
+{
+  release(&runqs[cpuid()].lock);
+}
+
+// Work was queued for cpu: wake it if it is idle, or else
+// wake some idle CPU that can steal the work.
+static void
+kick(int cpu)
+{
+  int i;
+
+  if(!cpus[cpu].idle){
+    for(i = 0; i < ncpu && !cpus[i].idle; i++)
+      ;
+    if(i == ncpu)
+      return;
+    cpu = i;
+  }
+  lapicipi(cpus[cpu].apicid, T_IRQ0 + IRQ_RESCHED);
+}
+
+// Return cpu if p may run there, or else the first CPU it may.
+static int
+allowedcpu(struct proc *p, int cpu)
+{
+  uint mask = p->affinity;
+  int i;
+
+  if(mask & (1 << cpu))
+    return cpu;
+  for(i = 0; i < ncpu; i++)
+    if(mask & (1 << i))
+      return i;
+  return cpu;
+}
+
+// Make p RUNNABLE on the queue of the CPU it last ran on,
+// or of one it is allowed on if it has been pinned elsewhere.
+static void
+makerunnable(struct proc *p)
+{
+  struct runq *rq;
+  int cpu;
+
+  if((cpu = allowedcpu(p, p->cpu)) != p->cpu){
+    // p may still be switching away on its old CPU.
+    acquire(&runqs[p->cpu].lock);
+    release(&runqs[p->cpu].lock);
+    p->cpu = cpu;
+  }
+  rq = &runqs[cpu];
+  acquire(&rq->lock);
+  if(p->state != RUNNABLE)
+    p->tsready = rdtsc();
+  p->state = RUNNABLE;
+  enqueue(rq, p);
+  release(&rq->lock);
+  kick(cpu);
+}
+
+// Return the process with the given pid, or 0.
+// Caller must hold ptable.lock.
+static struct proc*
+findproc(int pid)
+{
+  struct proc *p;
+
+  if(pid <= 0)
+    return 0;
+  for(p = ptable.pidhash[pid % NPIDHASH]; p; p = p->pidnext)
+    if(p->pid == pid)
+      return p;
+  return 0;
+}
+
+// Caller must hold ptable.lock.
+static void
+hashpid(struct proc *p)
+{
+  struct proc **pp = &ptable.pidhash[p->pid % NPIDHASH];
+
+  p->pidnext = *pp;
+  *pp = p;
+}
+
+// Caller must hold ptable.lock.
+static void
+unhashpid(struct proc *p)
+{
+  struct proc **pp;
+
+  for(pp = &ptable.pidhash[p->pid % NPIDHASH]; *pp != p; pp = &(*pp)->pidnext)
+    ;
+  *pp = p->pidnext;
+  p->pidnext = 0;
+}
+
+// Pick the next free pid. Pids wrap around after MAXPID, skipping
+// those still in use; 1 and 2 (init and sh, which the paging code
+// treats specially) are never reused.
+// Caller must hold ptable.lock.
+static int
+allocpid(void)
+{
+  int pid;
+
+  do {
+    pid = nextpid++;
+    if(nextpid > MAXPID)
+      nextpid = 3;
+  } while(findproc(pid) != 0);
+  return pid;
+}
+
+// Unlink p from every table and free it.
+// Caller must hold ptable.lock.
+static void
+freeproc(struct proc *p)
+{
+  unhashpid(p);
+  *p->allprev = p->allnext;
+  if(p->allnext)
+    p->allnext->allprev = p->allprev;
+  p->pid = 0;
+  p->state = UNUSED;
+  kmcache_free(ptable.cache, p);
+}
+
 //PAGEBREAK: 32
 // Look in the process table for an UNUSED proc.
 // If found, change state to EMBRYO and initialize
@@ -114,24 +437,32 @@ allocproc(void)
   struct proc *p;
   char *sp;
 
-  acquire(&ptable.lock);
-
-  for(p = ptable.proc; p < &ptable.proc[NPROC]; p++)
-    if(p->state == UNUSED)
-      goto found;
-
-  release(&ptable.lock);
-  return 0;
+  if((p = kmcache_alloc(ptable.cache)) == 0)
+    return 0;
+  memset(p, 0, sizeof(*p));
 
-found:
+  acquire(&ptable.lock);
   p->state = EMBRYO;
-  p->pid = nextpid++;
+  p->pid = allocpid();
+  hashpid(p);
+  p->allnext = ptable.all;
+  if(p->allnext)
+    p->allnext->allprev = &p->allnext;
+  p->allprev = &ptable.all;
+  ptable.all = p;
+  p->prio = p->base_prio = 0;
+  p->slice = 0;
+#if MLFQ
+  p->epoch = boostepoch;
+#endif
 
   release(&ptable.lock);
 
   // Allocate kernel stack.
   if((p->kstack = kalloc()) == 0){
-    p->state = UNUSED;
+    acquire(&ptable.lock);
+    freeproc(p);
+    release(&ptable.lock);
     return 0;
   }
   sp = p->kstack + KSTACKSIZE;
@@ -150,27 +481,125 @@ found:
   memset(p->context, 0, sizeof *p->context);
   p->context->eip = (uint)forkret;
 
-  // initialize process's page data
+  return p;
+}
+
+// Allocate an empty address space, with no page table yet.
+struct vmspace*
+vmalloc(void)
+{
+  struct vmspace *vm;
+  int i;
+
+  if((vm = kmcache_alloc(ptable.vmcache)) == 0)
+    return 0;
+  vm->ref = 1;
+  vm->sz = 0;
+  vm->pgdir = 0;
+  memset(vm->shm, 0, sizeof(vm->shm));
+  vm->swapFile = 0;
+  vm->swapid = 0;
+  vm->agetick = -1;
+  for (i = 0; i < MAX_PSYC_PAGES; i++) {
+    vm->swap_space_pages[i].va = (char*)0xffffffff;
+    vm->swap_space_pages[i].swaploc = 0;
+    vm->swap_space_pages[i].age = 0;
+    vm->swap_space_pages[i].flags = 0;
+    vm->free_pages[i].va = (char*)0xffffffff;
+    vm->free_pages[i].next = 0;
+    vm->free_pages[i].prev = 0;
+    vm->free_pages[i].age = 0;
+    vm->free_pages[i].flags = 0;
+  }
+  vm->page_fault_count = 0;
+  vm->page_swapped_count = 0;
+  vm->main_mem_pages = 0;
+  vm->swap_file_pages = 0;
+  vm->head = 0;
+  vm->tail = 0;
+  return vm;
+}
+
+// Drop a reference to vm, freeing it with the last one.
+// The caller must not be running on vm's page table.
+void
+vmput(struct vmspace *vm)
+{
+  int ref;
+
+  acquire(&ptable.lock);
+  ref = --vm->ref;
+  if(ref == 1)
+    wakeup(vm);  // see killthreads()
+  release(&ptable.lock);
+  if(ref > 0)
+    return;
+
+  shmexit(vm);
   #ifndef NONE
-    int i;
-    for (i = 0; i < MAX_PSYC_PAGES; i++) {
-      p->swap_space_pages[i].va = (char*)0xffffffff;
-      p->swap_space_pages[i].swaploc = 0;
-      p->swap_space_pages[i].age = 0;
-      p->free_pages[i].va = (char*)0xffffffff;
-      p->free_pages[i].next = 0;
-      p->free_pages[i].prev = 0;
-      p->free_pages[i].age = 0;
-    }
-    p->page_fault_count = 0;
-    p->page_swapped_count = 0;
-    p->main_mem_pages = 0;
-    p->swap_file_pages = 0;
-    p->head = 0;
-    p->tail = 0;
+    if(vm->swapFile)
+      removeSwapFile(vm);
   #endif
+  if(vm->pgdir)
+    freevm(vm->pgdir);
+  kmcache_free(ptable.vmcache, vm);
+}
 
-  return p;
+// Kill the other threads sharing the current address space and
+// wait for them to let go of it, as exec() must. Return -1 if
+// the caller is killed meanwhile.
+int
+killthreads(void)
+{
+  struct proc *curproc = myproc();
+  struct proc *p;
+
+  acquire(&ptable.lock);
+  for(p = ptable.all; p; p = p->allnext){
+    if(p != curproc && p->vm == curproc->vm){
+      p->killed = 1;
+      wakeproc(p);
+    }
+  }
+  while(curproc->vm->ref > 1){
+    if(curproc->killed){
+      release(&ptable.lock);
+      return -1;
+    }
+    sleep(curproc->vm, &ptable.lock);
+  }
+  release(&ptable.lock);
+  return 0;
+}
+
+// Flush stale TLB entries after mappings were removed from or
+// changed in vm: here, and on every other CPU running a thread
+// of vm, waiting until each has taken the IPI. Call it before
+// freeing or reusing the frames. The caller must hold no spinlock,
+// since those CPUs may be spinning on it with interrupts off.
+void
+tlbflush(struct vmspace *vm)
+{
+  struct proc *curproc = myproc();
+  struct proc *p;
+  struct cpu *c;
+  uint gen;
+
+  if(rcr3() == V2P(vm->pgdir))
+    lcr3(V2P(vm->pgdir));
+  // Publish the page table changes before looking at what the
+  // other CPUs run: one that switches to a thread of vm later
+  // loads the new entries.
+  __sync_synchronize();
+  for(c = cpus; c < cpus+ncpu; c++){
+    p = c->proc;
+    if(p == 0 || p == curproc || p->vm != vm)
+      continue;
+    gen = c->tlbgen;
+    lapicipi(c->apicid, T_IRQ0 + IRQ_TLB);
+    while(c->tlbgen == gen)
+      ;
+  }
 }
 
 //PAGEBREAK: 32
@@ -185,10 +614,11 @@ userinit(void)
   p = allocproc();
   
   initproc = p;
-  if((p->pgdir = setupkvm()) == 0)
+  if((p->vm = vmalloc()) == 0 || (p->vm->pgdir = setupkvm()) == 0 ||
+     (p->fdt = fdtalloc(0)) == 0)
     panic("userinit: out of memory?");
-  inituvm(p->pgdir, _binary_initcode_start, (int)_binary_initcode_size);
-  p->sz = PGSIZE;
+  inituvm(p->vm->pgdir, _binary_initcode_start, (int)_binary_initcode_size);
+  p->vm->sz = PGSIZE;
   memset(p->tf, 0, sizeof(*p->tf));
   p->tf->cs = (SEG_UCODE << 3) | DPL_USER;
   p->tf->ds = (SEG_UDATA << 3) | DPL_USER;
@@ -208,37 +638,107 @@ userinit(void)
   // run this process. the acquire forces the above
   // writes to be visible, and the lock is also needed
   // because the assignment might not be atomic.
-  acquire(&ptable.lock);
-
-  p->state = RUNNABLE;
-
-  release(&ptable.lock);
+  p->cpu = 0;
+  p->affinity = (1 << ncpu) - 1;
+  makerunnable(p);
+
+#if MLFQ
+  acquire(&tickslock);
+  boosttimer.fn = boost;
+  timeradd(&boosttimer, ticks + BOOSTTICKS);
+  release(&tickslock);
+#endif
 }
 
 // Grow current process's memory by n bytes.
-// Return 0 on success, -1 on failure.
+// Return the old size, or -1 on failure.
 int
 growproc(int n)
 {
-  uint sz;
-  struct proc *curproc = myproc();
+  uint sz, oldsz;
+  struct vmspace *vm = myproc()->vm;
 
-  sz = curproc->sz;
+  acquiresleep(&vm->lock);
+  sz = oldsz = vm->sz;
   if(n > 0){
     //cprintf("\ncalled n>0\n");
-    if((sz = allocuvm(curproc->pgdir, sz, sz + n)) == 0){
+    if((sz = allocuvm(vm->pgdir, sz, sz + n)) == 0){
       //cprintf("value of size = %d",sz);
+      releasesleep(&vm->lock);
       return -1;
     }
       
   } else if(n < 0){
-    if((sz = deallocuvm(curproc->pgdir, sz, sz + n)) == 0)
+    if((sz = deallocuvm(vm->pgdir, sz, sz + n)) == 0){
+      releasesleep(&vm->lock);
       return -1;
+    }
+  }
+  vm->sz = sz;
+  releasesleep(&vm->lock);
+  return oldsz;
+}
+
+#ifndef NONE
+// Give child a copy of parent's swap file.
+static int
+copySwapFile(struct proc *parent, struct proc *child)
+{
+  char buf[PGSIZE/2];
+  int off, n;
+
+  if(createSwapFile(child->vm, child->pid) < 0)
+    return -1;
+  if(parent->vm->swapFile == 0)
+    return 0;
+  for(off = 0; (n = readFromSwapFile(parent->vm, buf, off, PGSIZE/2)) > 0; off += n){
+    if(writeToSwapFile(child->vm, buf, off, n) != n){
+      removeSwapFile(child->vm);
+      return -1;
+    }
   }
-  curproc->sz = sz;
-  switchuvm(curproc);
   return 0;
 }
+#endif
+
+// Give back an EMBRYO that fork() or clone() could not finish.
+static void
+dropembryo(struct proc *p)
+{
+  if(p->vm)
+    vmput(p->vm);
+  if(p->fdt)
+    fdtput(p->fdt);
+  kfree(p->kstack);
+  p->kstack = 0;
+  acquire(&ptable.lock);
+  freeproc(p);
+  release(&ptable.lock);
+}
+
+// Make np, set up by fork() or clone(), a child of the
+// current process and let it run.
+static void
+startchild(struct proc *np)
+{
+  struct proc *curproc = myproc();
+
+  np->cwd = idup(curproc->cwd);
+  safestrcpy(np->name, curproc->name, sizeof(curproc->name));
+
+  acquire(&ptable.lock);
+  np->parent = curproc;
+  np->sibling = curproc->children;
+  curproc->children = np;
+  release(&ptable.lock);
+
+  np->prio = np->base_prio = curproc->base_prio;
+  np->affinity = curproc->affinity;
+  pushcli();
+  np->cpu = cpuid();
+  popcli();
+  makerunnable(np);
+}
 
 // Create a new process copying p as the parent.
 // Sets up stack to return as if from system call.
@@ -246,97 +746,135 @@ growproc(int n)
 int
 fork(void)
 {
-  int i, pid;
+  int pid;
   struct proc *np;
   struct proc *curproc = myproc();
+  struct vmspace *vm = curproc->vm, *nvm;
 
   // Allocate process.
   if((np = allocproc()) == 0){
     return -1;
   }
+  if((np->vm = nvm = vmalloc()) == 0 || (np->fdt = fdtalloc(curproc->fdt)) == 0){
+    dropembryo(np);
+    return -1;
+  }
 
-  // Copy process state from proc.
-  if((np->pgdir = copyuvm(curproc->pgdir, curproc->sz)) == 0){
-    kfree(np->kstack);
-    np->kstack = 0;
-    np->state = UNUSED;
+  // Copy process state from proc, with the other threads
+  // kept from paging meanwhile.
+  acquiresleep(&vm->lock);
+  if((nvm->pgdir = copyuvm(vm->pgdir, vm->sz)) == 0 ||
+     shmfork(vm, nvm) < 0){
+    releasesleep(&vm->lock);
+    dropembryo(np);
     return -1;
   }
 
   #ifndef NONE
-    np->main_mem_pages = curproc->main_mem_pages;
-    np->swap_file_pages = curproc->swap_file_pages;
+    nvm->main_mem_pages = vm->main_mem_pages;
+    nvm->swap_file_pages = vm->swap_file_pages;
+
+    if(curproc->pid > 2 && copySwapFile(curproc, np) < 0){
+      releasesleep(&vm->lock);
+      dropembryo(np);
+      return -1;
+    }
   #endif
 
-  np->sz = curproc->sz;
-  np->parent = curproc;
+  nvm->sz = vm->sz;
   *np->tf = *curproc->tf;
 
   // Clear %eax so that fork returns 0 in the child.
   np->tf->eax = 0;
 
-  for(i = 0; i < NOFILE; i++)
-    if(curproc->ofile[i])
-      np->ofile[i] = filedup(curproc->ofile[i]);
-  np->cwd = idup(curproc->cwd);
-
-  safestrcpy(np->name, curproc->name, sizeof(curproc->name));
-
   pid = np->pid;
 
   #ifndef NONE
-    if(curproc->pid > 2)
-    {
-      createSwapFile(np);
-      char buf[PGSIZE/2] = "";
-      int offset = 0;
-      int nread = 0;
-      while((nread == readFromSwapFile(curproc,buf, offset, PGSIZE/2))!=0)
-        if(writeToSwapFile(np, buf, offset, nread) == -1){
-          panic("fork: error while copying the parent's swap file to the child");
-        offset +=nread;
-      }
-    }
-
+    int i, j;
     for(i=0;i<MAX_PSYC_PAGES;i++){
-      np->free_pages[i].va = curproc->free_pages[i].va;
-      np->free_pages[i].age = curproc->free_pages[i].age;
-      np->swap_space_pages[i].va = curproc->swap_space_pages[i].va;
-      np->swap_space_pages[i].age = curproc->swap_space_pages[i].age;
-      np->swap_space_pages[i].swaploc = curproc->swap_space_pages[i].swaploc;
+      nvm->free_pages[i].va = vm->free_pages[i].va;
+      nvm->free_pages[i].age = vm->free_pages[i].age;
+      nvm->swap_space_pages[i].va = vm->swap_space_pages[i].va;
+      nvm->swap_space_pages[i].age = vm->swap_space_pages[i].age;
+      nvm->swap_space_pages[i].swaploc = vm->swap_space_pages[i].swaploc;
+      // mlock() pins are not inherited.
+      nvm->free_pages[i].flags = vm->free_pages[i].flags & ~FP_LOCKED;
+      nvm->swap_space_pages[i].flags = vm->swap_space_pages[i].flags & ~FP_LOCKED;
       }
 
-    int j;
     for(i = 0; i<MAX_PSYC_PAGES; i++){
       for(j=0;j<MAX_PSYC_PAGES;++j){
-        if(np->free_pages[j].va == curproc->free_pages[i].next->va)
-          np->free_pages[i].next = &np->free_pages[j];
-        if(np->free_pages[j].va == curproc->free_pages[i].prev->va)
-          np->free_pages[i].prev = &np->free_pages[j];
+        if(nvm->free_pages[j].va == vm->free_pages[i].next->va)
+          nvm->free_pages[i].next = &nvm->free_pages[j];
+        if(nvm->free_pages[j].va == vm->free_pages[i].prev->va)
+          nvm->free_pages[i].prev = &nvm->free_pages[j];
       }
     }  
     #if SCFIFO
       for (i = 0; i < MAX_PSYC_PAGES; i++) {
-        if (curproc->head->va == np->free_pages[i].va){
-          np->head = &np->free_pages[i];
+        if (vm->head->va == nvm->free_pages[i].va){
+          nvm->head = &nvm->free_pages[i];
         }
-        if (curproc->tail->va == np->free_pages[i].va){
-          np->tail = &np->free_pages[i];
+        if (vm->tail->va == nvm->free_pages[i].va){
+          nvm->tail = &nvm->free_pages[i];
         }
       }
     #elif FIFO
       for(i = 0;i<MAX_PSYC_PAGES;i++){
-        if(curproc->head->va == np->free_pages[i].va)
-          np->head = &np->free_pages[i];
-        if(curproc->tail->va == np->free_pages[i].va)
-          np->tail = &np->free_pages[i];
+        if(vm->head->va == nvm->free_pages[i].va)
+          nvm->head = &nvm->free_pages[i];
+        if(vm->tail->va == nvm->free_pages[i].va)
+          nvm->tail = &nvm->free_pages[i];
       }
     #endif
   #endif
+  releasesleep(&vm->lock);
 
+  startchild(np);
+  return pid;
+}
+
+// Create a thread: a child process that shares the current
+// address space and open files, and starts in fn(arg) on the
+// PGSIZE-byte user stack at stack. Returning from fn faults,
+// so fn should end with exit(). Return the new thread's pid.
+int
+clone(void (*fn)(void*), void *arg, void *stack)
+{
+  struct proc *np;
+  struct proc *curproc = myproc();
+  struct vmspace *vm = curproc->vm;
+  uint sp, ustack[2];
+  int pid;
+
+  sp = (uint)stack + PGSIZE;
+  if((uint)stack >= sp)
+    return -1;
+  // Push arg and a fake return PC. copyoutvm() checks that they
+  // land in user pages, not in something like the guard page
+  // under the main stack, while no sibling thread can unmap them.
+  ustack[0] = 0xffffffff;
+  ustack[1] = (uint)arg;
+  sp -= sizeof(ustack);
+  if(copyoutvm(vm, sp, ustack, sizeof(ustack)) < 0)
+    return -1;
+
+  if((np = allocproc()) == 0)
+    return -1;
   acquire(&ptable.lock);
-  np->state = RUNNABLE;
+  np->vm = curproc->vm;
+  np->vm->ref++;
   release(&ptable.lock);
+  np->fdt = fdtdup(curproc->fdt);
+
+  *np->tf = *curproc->tf;
+  np->tf->eip = (uint)fn;
+  np->tf->esp = sp;
+  np->thread = 1;
+  np->ustack = stack;
+
+  pid = np->pid;
+  startchild(np);
   return pid;
 }
 
@@ -370,10 +908,14 @@ void custom_proc_print(struct proc *proc)
       for(i=0; i<10 && pc[i] != 0; i++)
         cprintf(" %p", pc[i]);
   }
-  cprintf("\nNo. of pages currently in physical memory: %d,\n", proc->main_mem_pages);
-  cprintf("No. of pages currently in swap space: %d,\n", proc->swap_file_pages);
-  cprintf("Count of page faults: %d,\n", proc->page_fault_count);
-  cprintf("Count of paged out pages: %d,\n\n", proc->page_swapped_count);
+  if(proc->vm == 0){
+    cprintf("\n\n");
+    return;
+  }
+  cprintf("\nNo. of pages currently in physical memory: %d,\n", proc->vm->main_mem_pages);
+  cprintf("No. of pages currently in swap space: %d,\n", proc->vm->swap_file_pages);
+  cprintf("Count of page faults: %d,\n", proc->vm->page_fault_count);
+  cprintf("Count of paged out pages: %d,\n\n", proc->vm->page_swapped_count);
   
  }
 
@@ -390,86 +932,100 @@ exit(void)
   struct proc *curproc = myproc();
   //cprintf("called_exit %s", curproc->name);
   struct proc *p;
-  int fd;
+  struct vmspace *vm;
 
   if(curproc == initproc)
     panic("init exiting");
 
-  // Close all open files.
-  for(fd = 0; fd < NOFILE; fd++){
-    if(curproc->ofile[fd]){
-      fileclose(curproc->ofile[fd]);
-      curproc->ofile[fd] = 0;
-    }
-  }
-  #ifndef NONE
-    if(curproc->pid >2 &&  curproc->swapFile!=0 && curproc->swapFile->ref > 0)
-    {
-      removeSwapFile(curproc);
-    }
-  #endif
-
   #if TRUE
     if(cuscmp(curproc->name,"sh") != 0)
       custom_proc_print(curproc);
   #endif
-    
+
+  // Close all open files, unless other threads still use them.
+  fdtput(curproc->fdt);
+  curproc->fdt = 0;
 
   begin_op();
   iput(curproc->cwd);
   end_op();
   curproc->cwd = 0;
 
+  // Leave the address space; the last thread to do so frees
+  // it, shared memory and swap file included. Switch to the
+  // kernel page table first, in case that is another thread.
+  switchkvm();
+  acquire(&ptable.lock);
+  vm = curproc->vm;
+  curproc->vm = 0;
+  release(&ptable.lock);
+  vmput(vm);
+
   acquire(&ptable.lock);
 
   // Parent might be sleeping in wait().
-  wakeup1(curproc->parent);
+  wakeup(curproc->parent);
   
 
-  // Pass abandoned children to init.
-  for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
-    if(p->parent == curproc){
+  // Pass abandoned children to init, which reaps
+  // threads too.
+  if((p = curproc->children) != 0){
+    for(;; p = p->sibling){
       p->parent = initproc;
+      p->thread = 0;
       if(p->state == ZOMBIE)
-        wakeup1(initproc);
+        wakeup(initproc);
+      if(p->sibling == 0)
+        break;
     }
+    p->sibling = initproc->children;
+    initproc->children = curproc->children;
+    curproc->children = 0;
   }
   //cprintf("called2\n");
   // Jump into the scheduler, never to return.
   curproc->state = ZOMBIE;
+  lockmyrunq();
+  release(&ptable.lock);
   sched();
   panic("zombie exit");
 }
 
-// Wait for a child process to exit and return its pid.
-// Return -1 if this process has no children.
-int
-wait(void)
+// Wait for a child made by fork() (or, if thread is set, by
+// clone()) to exit and return its pid, and in *stack the user
+// stack of a thread. Return -1 if there is no such child.
+static int
+reap(int thread, void **stack)
 {
-  struct proc *p;
+  struct proc *p, **pp;
   int havekids, pid;
+  void *ustack;
   struct proc *curproc = myproc();
   
   acquire(&ptable.lock);
   for(;;){
-    // Scan through table looking for exited children.
+    // Scan through our children looking for exited ones.
     havekids = 0;
-    for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
-      if(p->parent != curproc)
+    for(pp = &curproc->children; (p = *pp) != 0; pp = &p->sibling){
+      if(p->thread != thread)
         continue;
       havekids = 1;
       if(p->state == ZOMBIE){
-        // Found one.
+        // Found one. It may still be on its way into the
+        // scheduler; its CPU's run queue lock is held until
+        // it is off its kernel stack.
+        acquire(&runqs[p->cpu].lock);
+        release(&runqs[p->cpu].lock);
         pid = p->pid;
+        ustack = p->ustack;
         kfree(p->kstack);
         p->kstack = 0;
-        freevm(p->pgdir);
-        p->pid = 0;
-        p->parent = 0;
-        p->name[0] = 0;
-        p->killed = 0;
-        p->state = UNUSED;
+        *pp = p->sibling;
+        freeproc(p);
         release(&ptable.lock);
+        // Not under ptable.lock: this may fault the page in.
+        if(stack)
+          *stack = ustack;
         return pid;
       }
     }
@@ -480,16 +1036,92 @@ wait(void)
       return -1;
     }
 
-    // Wait for children to exit.  (See wakeup1 call in proc_exit.)
+    // Wait for children to exit.  (See wakeup call in proc_exit.)
     sleep(curproc, &ptable.lock);  //DOC: wait-sleep
   }
 }
 
+// Wait for a child process to exit and return its pid.
+// Return -1 if this process has no children.
+int
+wait(void)
+{
+  return reap(0, 0);
+}
+
+// Wait for a thread this thread made with clone() to exit.
+// Return its pid and set *stack to the stack given to clone(),
+// which the caller may now free. Return -1 if there is none.
+int
+join(void **stack)
+{
+  return reap(1, stack);
+}
+
 //PAGEBREAK: 42
+// Take a RUNNABLE process allowed on CPU me from another CPU's
+// run queue, or 0. Locks one queue at a time; the stolen process
+// is on no queue until the caller runs it.
+static struct proc*
+steal(int me)
+{
+  struct runq *rq;
+  struct proc *p;
+  int i;
+
+  for(i = 1; i < ncpu; i++){
+    rq = &runqs[(me + i) % ncpu];
+    if(rq->len == 0)
+      continue;
+    acquire(&rq->lock);
+    p = dequeue(rq, 1 << me);
+    release(&rq->lock);
+    if(p)
+      return p;
+  }
+  return 0;
+}
+
+// Nothing to run: halt until an interrupt, such as the IPI from
+// kick(). The periodic tick is off meanwhile; CPU 0, which keeps
+// time, sets a one-shot timer for the next timer wheel deadline
+// and catches up on the ticks when it wakes.
+static void
+idle(struct cpu *c, struct runq *rq)
+{
+  uint n;
+
+  cli();
+  // Publish idle before the last look at the queue; kick()
+  // reads it after queueing, so one of us sees the other.
+  c->idle = 1;
+  __sync_synchronize();
+  if(rq->len == 0){
+    // Go tickless under tickslock, so that timeradd() either
+    // sees the deadline or adds its timer before timernext().
+    n = 0;
+    if(c == &cpus[0]){
+      acquire(&tickslock);
+      n = timernext() - ticks;
+      c->deadline = ticks + n;
+      c->tickless = 1;
+      release(&tickslock);
+    } else
+      c->tickless = 1;
+    lapiconeshot(n);
+    stihlt();
+    cli();
+    timerresume();
+  }
+  c->idle = 0;
+  sti();
+}
+
 // Per-CPU process scheduler.
 // Each CPU calls scheduler() after setting itself up.
 // Scheduler never returns.  It loops, doing:
-//  - choose a process to run
+//  - choose a process from this CPU's run queue, or
+//    steal one from another CPU's
 //  - swtch to start running that process
 //  - eventually that process transfers control
 //      via swtch back to the scheduler.
@@ -498,39 +1130,68 @@ scheduler(void)
 {
   struct proc *p;
   struct cpu *c = mycpu();
+  int me = c - cpus;
+  struct runq *rq = &runqs[me];
+  uint64 now, last;
+  int moved;
   c->proc = 0;
+  last = rdtsc();
   
   for(;;){
     // Enable interrupts on this processor.
     sti();
 
-    // Loop over process table looking for process to run.
-    acquire(&ptable.lock);
-    for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
-      if(p->state != RUNNABLE)
+    acquire(&rq->lock);
+    if((p = dequeue(rq, ~0)) == 0){
+      release(&rq->lock);
+      if((p = steal(me)) == 0){
+        idle(c, rq);
         continue;
-
-      // Switch to chosen process.  It is the process's job
-      // to release ptable.lock and then reacquire it
-      // before jumping back to us.
-      c->proc = p;
-      switchuvm(p);
-      p->state = RUNNING;
-
-      swtch(&(c->scheduler), p->context);
-      //cprintf("done executing: pid = %d\n",p->pid);
-      switchkvm();
-
-      // Process is done running for now.
-      // It should have changed its p->state before coming back.
-      c->proc = 0;
+      }
+      acquire(&rq->lock);
+    } else if(!(p->affinity & (1 << me))){
+      // Pinned elsewhere while it waited here.
+      release(&rq->lock);
+      makerunnable(p);
+      continue;
     }
-    release(&ptable.lock);
 
+    // Switch to chosen process.  It is the process's job
+    // to release rq->lock and then reacquire it
+    // before jumping back to us.
+    // The time from here until the process is back in
+    // sched() or forkret() is counted as switch time.
+    if(p->cpu != me)
+      c->nmigrate++;
+    c->nswitch++;
+    now = c->tsswtch = rdtsc();
+    c->idletime += now - last;
+    p->waittime += now - p->tsready;
+    p->cpu = me;
+    c->proc = p;
+    switchuvm(p);
+    p->state = RUNNING;
+
+    swtch(&(c->scheduler), p->context);
+    //cprintf("done executing: pid = %d\n",p->pid);
+    switchkvm();
+    last = rdtsc();
+    p->runtime += last - c->tsswtch;
+    c->busytime += last - c->tsswtch;
+
+    // Process is done running for now.
+    // It should have changed its p->state before coming back.
+    // yield() leaves a process pinned elsewhere off our queue,
+    // for us to move once its context is saved.
+    c->proc = 0;
+    moved = p->state == RUNNABLE && p->cpu != me;
+    release(&rq->lock);
+    if(moved)
+      makerunnable(p);
   }
 }
 
-// Enter scheduler.  Must hold only ptable.lock
+// Enter scheduler.  Must hold only this CPU's run queue lock
 // and have changed proc->state. Saves and restores
 // intena because intena is a property of this
 // kernel thread, not this CPU. It should
@@ -543,27 +1204,64 @@ sched(void)
   int intena;
   struct proc *p = myproc();
 
-  if(!holding(&ptable.lock))
-    panic("sched ptable.lock");
+  if(readeflags()&FL_IF)
+    panic("sched interruptible");
+  if(!holding(&runqs[cpuid()].lock))
+    panic("sched runq lock");
   if(mycpu()->ncli != 1)
     panic("sched locks");
   if(p->state == RUNNING)
     panic("sched running");
-  if(readeflags()&FL_IF)
-    panic("sched interruptible");
   intena = mycpu()->intena;
   swtch(&p->context, mycpu()->scheduler);
+  mycpu()->swtchtime += rdtsc() - mycpu()->tsswtch;
   mycpu()->intena = intena;
 }
 
+// Called on each timer tick by the running process. With MLFQ,
+// it only gives up the CPU once its time slice is used up, and
+// then drops a level.
+void
+schedtick(void)
+{
+#if MLFQ
+  struct proc *p = myproc();
+
+  if(++p->slice < 1 << p->prio)
+    return;
+  if(p->prio < NPRIO - 1)
+    p->prio++;
+  p->slice = 0;
+#endif
+  myproc()->nivcsw++;
+  requeue();
+}
+
 // Give up the CPU for one scheduling round.
 void
 yield(void)
 {
-  acquire(&ptable.lock);  //DOC: yieldlock
-  myproc()->state = RUNNABLE;
+  myproc()->nvcsw++;
+  requeue();
+}
+
+// Put the current process back on a run queue and
+// switch away from it.
+static void
+requeue(void)
+{
+  struct runq *rq;
+  struct proc *p = myproc();
+
+  rq = lockmyrunq();  //DOC: yieldlock
+  p->state = RUNNABLE;
+  p->tsready = rdtsc();
+  if(p->affinity & (1 << cpuid()))
+    enqueue(rq, p);
+  else
+    p->cpu = allowedcpu(p, cpuid());  // scheduler() moves it
   sched();
-  release(&ptable.lock);
+  unlockmyrunq();
 }
 
 // A fork child's very first scheduling by scheduler()
@@ -572,8 +1270,9 @@ void
 forkret(void)
 {
   static int first = 1;
-  // Still holding ptable.lock from scheduler.
-  release(&ptable.lock);
+  // Still holding the run queue lock from scheduler.
+  mycpu()->swtchtime += rdtsc() - mycpu()->tsswtch;
+  unlockmyrunq();
 
   if (first) {
     // Some initialization functions must be run in the context
@@ -593,6 +1292,7 @@ void
 sleep(void *chan, struct spinlock *lk)
 {
   struct proc *p = myproc();
+  struct waitq *wq;
   
   if(p == 0)
     panic("sleep");
@@ -600,52 +1300,226 @@ sleep(void *chan, struct spinlock *lk)
   if(lk == 0)
     panic("sleep without lk");
 
-  // Must acquire ptable.lock in order to
+  // Must acquire the wait queue lock in order to
   // change p->state and then call sched.
-  // Once we hold ptable.lock, we can be
-  // guaranteed that we won't miss any wakeup
-  // (wakeup runs with ptable.lock locked),
-  // so it's okay to release lk.
-  if(lk != &ptable.lock){  //DOC: sleeplock0
-    acquire(&ptable.lock);  //DOC: sleeplock1
-    release(lk);
-  }
-  // Go to sleep.
+  // Once we hold it, we can be guaranteed that
+  // we won't miss any wakeup (wakeup runs with
+  // the wait queue locked), so it's okay to release lk.
+  wq = chanwaitq(chan);
+  acquire(&wq->lock);  //DOC: sleeplock1
+  release(lk);
+
+  // Go to sleep. A wakeup that comes once the wait queue
+  // is released waits for our run queue lock, held until
+  // the scheduler has switched away from us.
   p->chan = chan;
   p->state = SLEEPING;
+  p->nvcsw++;
+  p->wqnext = wq->head;
+  wq->head = p;
+  lockmyrunq();
+  release(&wq->lock);
 
   sched();
-
-  // Tidy up.
-  p->chan = 0;
+  unlockmyrunq();
 
   // Reacquire original lock.
-  if(lk != &ptable.lock){  //DOC: sleeplock2
-    release(&ptable.lock);
-    acquire(lk);
-  }
+  acquire(lk);
 }
 
 //PAGEBREAK!
-// Wake up all processes sleeping on chan.
-// The ptable lock must be held.
+// Take p, sleeping on wq, off it and make it RUNNABLE.
+// Caller must hold wq->lock.
 static void
-wakeup1(void *chan)
+wakeup1(struct waitq *wq, struct proc *p)
 {
-  struct proc *p;
+  struct proc **pp;
 
-  for(p = ptable.proc; p < &ptable.proc[NPROC]; p++)
-    if(p->state == SLEEPING && p->chan == chan)
-      p->state = RUNNABLE;
+  for(pp = &wq->head; *pp != p; pp = &(*pp)->wqnext)
+    ;
+  *pp = p->wqnext;
+  p->wqnext = 0;
+  p->chan = 0;
+#if MLFQ
+  // It gave up the CPU before its slice was over.
+  if(p->prio > p->base_prio)
+    p->prio--;
+  p->slice = 0;
+#endif
+  makerunnable(p);
 }
 
 // Wake up all processes sleeping on chan.
 void
 wakeup(void *chan)
 {
+  struct waitq *wq = chanwaitq(chan);
+  struct proc *p, *next;
+
+  acquire(&wq->lock);
+  for(p = wq->head; p; p = next){
+    next = p->wqnext;
+    if(p->chan == chan)
+      wakeup1(wq, p);
+  }
+  release(&wq->lock);
+}
+
+// Wake p if it is asleep, whatever it sleeps on.
+static void
+wakeproc(struct proc *p)
+{
+  struct waitq *wq;
+  void *chan;
+
+  // p may be woken, and even go back to sleep on
+  // another channel, before its wait queue is locked.
+  while(p->state == SLEEPING && (chan = p->chan) != 0){
+    wq = chanwaitq(chan);
+    acquire(&wq->lock);
+    if(p->state == SLEEPING && p->chan == chan){
+      wakeup1(wq, p);
+      release(&wq->lock);
+      return;
+    }
+    release(&wq->lock);
+  }
+}
+
+// Called when a user page allocation finds memory exhausted.
+// Kill the user process with the most pages, resident plus swapped,
+// with all its threads, unless a victim is already on its way out.
+// Return the victim's pid, or -1 if there is nothing to kill.
+int
+oomkill(void)
+{
+  struct proc *p, *victim;
+
+  acquire(&ptable.lock);
+  free_page_counts.reclaim_stalls++;
+  victim = 0;
+  for(p = ptable.all; p; p = p->allnext){
+    if(p->pid <= 2 || p->state == UNUSED || p->state == EMBRYO || p->state == ZOMBIE ||
+       p->vm == 0)
+      continue;
+    if(p->killed){
+      release(&ptable.lock);
+      return p->pid;
+    }
+    if(victim == 0 || p->vm->main_mem_pages + p->vm->swap_file_pages >
+                      victim->vm->main_mem_pages + victim->vm->swap_file_pages)
+      victim = p;
+  }
+  if(victim == 0){
+    release(&ptable.lock);
+    return -1;
+  }
+  cprintf("out of memory: killing pid %d (%s), %d pages\n", victim->pid,
+          victim->name, victim->vm->main_mem_pages + victim->vm->swap_file_pages);
+  for(p = ptable.all; p; p = p->allnext){
+    if(p->vm == victim->vm){
+      p->killed = 1;
+      wakeproc(p);
+    }
+  }
+  free_page_counts.oom_kills++;
+  release(&ptable.lock);
+  return victim->pid;
+}
+
+// Set the top run queue level of process pid, 0 being the
+// highest, from the next time it is queued. Only MLFQ uses
+// levels. Return its old top level, or -1 on error.
+int
+setpriority(int pid, int prio)
+{
+  struct proc *p;
+  int old;
+
+  if(prio < 0 || prio >= NPRIO)
+    return -1;
   acquire(&ptable.lock);
-  wakeup1(chan);
+  if((p = findproc(pid)) != 0){
+    old = p->base_prio;
+    p->base_prio = prio;
+    p->prio = prio;
+    p->slice = 0;
+    release(&ptable.lock);
+    return old;
+  }
   release(&ptable.lock);
+  return -1;
+}
+
+// Pin process pid to the CPUs in mask, one bit each. A running
+// process moves the next time it gives up the CPU; the caller
+// moves at once. Return its old mask, or -1 on error.
+int
+sched_setaffinity(int pid, uint mask)
+{
+  struct proc *p;
+  uint old;
+
+  mask &= (1 << ncpu) - 1;
+  if(mask == 0)
+    return -1;
+  acquire(&ptable.lock);
+  if((p = findproc(pid)) == 0){
+    release(&ptable.lock);
+    return -1;
+  }
+  old = p->affinity;
+  p->affinity = mask;
+  release(&ptable.lock);
+  if(p == myproc() && !(mask & (1 << p->cpu)))
+    yield();
+  return old;
+}
+
+// Copy the scheduling counters of up to n CPUs to st.
+// Return the number of CPUs.
+int
+getcpustat(struct cpustat *st, int n)
+{
+  int i;
+
+  for(i = 0; i < n && i < ncpu; i++){
+    st[i].nswitch = cpus[i].nswitch;
+    st[i].nmigrate = cpus[i].nmigrate;
+    st[i].nqueued = runqs[i].len;
+    st[i].idle = cpus[i].idle;
+    st[i].busytime = cpus[i].busytime;
+    st[i].idletime = cpus[i].idletime;
+    st[i].swtchtime = cpus[i].swtchtime;
+  }
+  return ncpu;
+}
+
+// Copy the scheduling statistics of up to n processes to ps.
+// Return the number copied.
+int
+getprocstat(struct procstat *ps, int n)
+{
+  struct proc *p;
+  int i;
+
+  i = 0;
+  acquire(&ptable.lock);
+  for(p = ptable.all; p && i < n; p = p->allnext){
+    if(p->state == UNUSED)
+      continue;
+    ps[i].pid = p->pid;
+    ps[i].state = p->state;
+    ps[i].cpu = p->cpu;
+    safestrcpy(ps[i].name, p->name, sizeof(ps[i].name));
+    ps[i].runtime = p->runtime;
+    ps[i].waittime = p->waittime;
+    ps[i].nvcsw = p->nvcsw;
+    ps[i].nivcsw = p->nivcsw;
+    i++;
+  }
+  release(&ptable.lock);
+  return i;
 }
 
 // Kill the process with the given pid.
@@ -657,15 +1531,12 @@ kill(int pid)
   struct proc *p;
 
   acquire(&ptable.lock);
-  for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
-    if(p->pid == pid){
-      p->killed = 1;
-      // Wake process from sleep if necessary.
-      if(p->state == SLEEPING)
-        p->state = RUNNABLE;
-      release(&ptable.lock);
-      return 0;
-    }
+  if((p = findproc(pid)) != 0){
+    p->killed = 1;
+    // Wake process from sleep if necessary.
+    wakeproc(p);
+    release(&ptable.lock);
+    return 0;
   }
   release(&ptable.lock);
   return -1;
@@ -674,19 +1545,27 @@ kill(int pid)
 //PAGEBREAK: 36
 // Print a process listing to console.  For debugging.
 // Runs when user types ^P on console.
-// No lock to avoid wedging a stuck machine further.
+// Takes ptable.lock, since exited processes are freed.
 
 void
 procdump(void)
 {
     struct proc *p;
-    int percentage;
+    struct bcstat bc;
+    int percentage, i;
 
-    for(p = ptable.proc; p<&ptable.proc[NPROC]; p++){
+    acquire(&ptable.lock);
+    for(p = ptable.all; p; p = p->allnext){
       if(p->state == UNUSED)
         continue;
       custom_proc_print(p);
     }
+    release(&ptable.lock);
+    for(i = 0; i < ncpu; i++)
+      cprintf("\n CPU %d: %d switches, %d migrations", i, cpus[i].nswitch, cpus[i].nmigrate);
     percentage = (free_page_counts.num_curr_free_pages*100)/free_page_counts.num_init_free_pages;
     cprintf("\n\n Number of free physical pages: %d/%d ~ %d%% \n",free_page_counts.num_curr_free_pages,free_page_counts.num_init_free_pages, percentage);
+    cprintf(" Memory reclaim stalls: %d, OOM kills: %d\n", free_page_counts.reclaim_stalls, free_page_counts.oom_kills);
+    bcachestat(&bc);
+    cprintf(" Buffer cache: %d/%d buffers, %d hits, %d misses, %d given back\n", bc.nbuf, bc.maxbuf, bc.hits, bc.misses, bc.shrunk);
 }
\ No newline at end of file
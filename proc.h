@@ -1,4 +1,16 @@
 #define MAX_PSYC_PAGES 15
+
+// Scheduler run queue levels. With SCHEDULER=MLFQ a process
+// starts at the top level, 0, and gets a time slice of 1<<level ticks;
+// one that uses up its slice drops a level, one that sleeps
+// rises a level, and every BOOSTTICKS all go back to the top.
+// setpriority() lowers the top level for a process.
+#if MLFQ
+#define NPRIO       4
+#define BOOSTTICKS  100
+#else
+#define NPRIO       1
+#endif
 #define MAX_TOTAL_PAGES 30
 
 // Per-CPU state
@@ -11,6 +23,17 @@ struct cpu {
   int ncli;                    // Depth of pushcli nesting.
   int intena;                  // Were interrupts enabled before pushcli?
   struct proc *proc;           // The process running on this cpu or null
+  volatile int idle;           // Halted in scheduler, waiting for work
+  volatile int tickless;       // Periodic timer stopped while idle
+  uint deadline;               // Tick the one-shot timer is set for, if tickless
+  volatile uint nresume;       // Times it left tickless idle
+  volatile uint tlbgen;        // TLB flush IPIs handled; see tlbflush()
+  uint nswitch;                // Processes switched to
+  uint nmigrate;               // Of those, ones that last ran on another CPU
+  uint64 busytime;             // TSC cycles spent running processes
+  uint64 idletime;             // TSC cycles spent in scheduler() and halted
+  uint64 swtchtime;            // TSC cycles spent switching to processes
+  uint64 tsswtch;              // When scheduler() last called swtch()
 };
 
 extern struct cpu cpus[NCPU];
@@ -37,45 +60,38 @@ struct context {
 
 enum procstate { UNUSED, EMBRYO, SLEEPING, RUNNABLE, RUNNING, ZOMBIE };
 
-struct freepg {
-  char *va;
-  int age;
-  struct freepg *next;
-  struct freepg *prev;
-  uint swaploc;
-};
-
 // Per-process state
 struct proc {
-  uint sz;                     // Size of process memory (bytes)
-  pde_t* pgdir;                // Page table
+  struct vmspace *vm;          // Address space, shared with threads
   char *kstack;                // Bottom of kernel stack for this process
   enum procstate state;        // Process state
   int pid;                     // Process ID
   struct proc *parent;         // Parent process
+  struct proc *children;       // First child
+  struct proc *sibling;        // Next child of parent
+  struct proc *pidnext;        // Next in pid hash chain
+  struct proc *allnext;        // Next in list of all processes
+  struct proc **allprev;       // Link pointing at this process
   struct trapframe *tf;        // Trap frame for current syscall
   struct context *context;     // swtch() here to run process
   void *chan;                  // If non-zero, sleeping on chan
   int killed;                  // If non-zero, have been killed
-  struct file *ofile[NOFILE];  // Open files
+  struct fdtable *fdt;         // Open files, shared with threads
   struct inode *cwd;           // Current directory
   char name[16];               // Process name (debugging)
-  
-  struct file *swapFile;
-
-  int main_mem_pages;
-  int swap_file_pages;
-  int page_fault_count;
-  int page_swapped_count;
-
-  struct freepg free_pages[MAX_PSYC_PAGES];
-  struct freepg swap_space_pages[MAX_PSYC_PAGES];
-  struct freepg *head;
-  struct freepg *tail;
+  struct proc *rqnext;         // Next in run queue
+  int prio;                    // Run queue level, 0 is highest
+  int base_prio;               // Highest level it may reach; see setpriority()
+  int slice;                   // Ticks used of its time slice (MLFQ)
+  uint epoch;                  // Boost epoch it was last queued in (MLFQ)
+  struct proc *wqnext;         // Next in wait queue, while sleeping
+  int cpu;                     // CPU it last ran on; whose run queue it joins
+  uint affinity;               // CPUs it may run on, one bit each
+  int thread;                  // Made by clone(): reaped by join(), not wait()
+  void *ustack;                // User stack passed to clone(), for join()
+  uint64 tsready;              // When it last became RUNNABLE (TSC)
+  uint64 runtime;              // TSC cycles spent RUNNING
+  uint64 waittime;             // TSC cycles spent RUNNABLE, waiting for a CPU
+  uint nvcsw;                  // Times it gave up the CPU itself
+  uint nivcsw;                 // Times it was preempted
 };
-
-// Process memory is laid out contiguously, low addresses first:
-//   text
-//   original data and bss
-//   fixed-size stack
-//   expandable heap
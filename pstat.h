@@ -0,0 +1,12 @@
+// Per-process scheduling statistics, as returned by getprocstat().
+// Times are in TSC cycles.
+struct procstat {
+  int pid;
+  int state;       // UNUSED .. ZOMBIE, as in proc.h
+  int cpu;         // CPU it last ran on
+  char name[16];
+  uint64 runtime;  // Time spent running
+  uint64 waittime; // Time spent runnable, waiting for a CPU
+  uint nvcsw;      // Times it gave up the CPU itself
+  uint nivcsw;     // Times it was preempted
+};
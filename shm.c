@@ -0,0 +1,263 @@
+// Shared-memory segments.
+//
+// A segment is a set of physical pages that several processes
+// map into their address spaces, so bulk data can move between
+// them without the copying a pipe does.
+//
+// Interface:
+// * shmget(key, size) finds the segment with the given key, or
+//   creates one of at least size bytes. Key 0 always creates a
+//   new, private segment.
+// * shmat(id) maps the segment into the calling process and
+//   returns its address. Segment id always lives at the same
+//   address, SHMBASE + id*SHMMAXPAGES*PGSIZE, in every process.
+// * shmdt(addr) unmaps the segment mapped at addr.
+//
+// A segment's refcnt counts the address spaces that have it
+// attached; its frames are freed when the last one detaches.
+// fork() attaches the child to all of the parent's segments,
+// while exec() and the exit of the last thread detach everything.
+//
+// Shared pages carry PTE_SHM and are never tracked by the
+// page-replacement code, so they stay resident while attached.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "memlayout.h"
+#include "mmu.h"
+#include "x86.h"
+#include "proc.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "vmspace.h"
+
+struct shmseg {
+  int key;
+  int npages;      // 0 if this slot is unused
+  int refcnt;      // number of attached address spaces
+  char *pages[SHMMAXPAGES];
+};
+
+struct {
+  struct spinlock lock;
+  struct shmseg seg[NSHM];
+} shmtable;
+
+static char*
+shmaddr(int id)
+{
+  return (char*)(SHMBASE + id*SHMMAXPAGES*PGSIZE);
+}
+
+void
+shminit(void)
+{
+  if(SHMBASE + (uint)NSHM*SHMMAXPAGES*PGSIZE > KERNBASE)
+    panic("shminit: segments overlap kernel");
+  initlock(&shmtable.lock, "shm");
+}
+
+// Remove the PTEs of the first n pages of s from pgdir.
+// Caller must hold shmtable.lock.
+static void
+shmunmap(pde_t *pgdir, struct shmseg *s, int id, int n)
+{
+  pte_t *pte;
+  int i;
+
+  for(i = 0; i < n; i++){
+    if((pte = walkpgdir(pgdir, shmaddr(id) + i*PGSIZE, 0)) != 0)
+      *pte = 0;
+  }
+}
+
+// Map all pages of s into pgdir. Caller must hold shmtable.lock.
+static int
+shmmap(pde_t *pgdir, struct shmseg *s, int id)
+{
+  int i;
+
+  for(i = 0; i < s->npages; i++){
+    if(mappages(pgdir, shmaddr(id) + i*PGSIZE, PGSIZE,
+                V2P(s->pages[i]), PTE_W|PTE_U|PTE_SHM) < 0){
+      shmunmap(pgdir, s, id, i);
+      return -1;
+    }
+  }
+  return 0;
+}
+
+// Drop one reference to s, freeing its frames with the last one.
+// Caller must hold shmtable.lock.
+static void
+shmput(struct shmseg *s)
+{
+  int i;
+
+  if(--s->refcnt > 0)
+    return;
+  for(i = 0; i < s->npages; i++)
+    kfree(s->pages[i]);
+  s->npages = 0;
+  s->key = 0;
+}
+
+// Return the id of the segment with the given key, creating
+// it if needed. Return -1 on error.
+int
+shmget(int key, int size)
+{
+  struct shmseg *s, *free;
+  int i, npages;
+
+  if(key < 0 || size <= 0)
+    return -1;
+  npages = PGROUNDUP(size) / PGSIZE;
+  if(npages > SHMMAXPAGES)
+    return -1;
+
+  acquire(&shmtable.lock);
+  free = 0;
+  for(s = shmtable.seg; s < &shmtable.seg[NSHM]; s++){
+    if(s->npages == 0){
+      if(free == 0)
+        free = s;
+    } else if(key != 0 && s->key == key){
+      release(&shmtable.lock);
+      return npages <= s->npages ? s - shmtable.seg : -1;
+    }
+  }
+  if(free == 0){
+    release(&shmtable.lock);
+    return -1;
+  }
+  s = free;
+  for(i = 0; i < npages; i++){
+    if((s->pages[i] = kalloc()) == 0){
+      while(--i >= 0)
+        kfree(s->pages[i]);
+      release(&shmtable.lock);
+      return -1;
+    }
+    memset(s->pages[i], 0, PGSIZE);
+  }
+  s->key = key;
+  s->npages = npages;
+  s->refcnt = 0;
+  release(&shmtable.lock);
+  return s - shmtable.seg;
+}
+
+// Attach segment id to the current process.
+// Return its address, or 0 on error.
+char*
+shmat(int id)
+{
+  struct vmspace *vm = myproc()->vm;
+  struct shmseg *s;
+
+  if(id < 0 || id >= NSHM)
+    return 0;
+  acquiresleep(&vm->lock);
+  acquire(&shmtable.lock);
+  s = &shmtable.seg[id];
+  if(s->npages == 0 || vm->shm[id] || shmmap(vm->pgdir, s, id) < 0){
+    release(&shmtable.lock);
+    releasesleep(&vm->lock);
+    return 0;
+  }
+  s->refcnt++;
+  vm->shm[id] = 1;
+  release(&shmtable.lock);
+  releasesleep(&vm->lock);
+  lcr3(V2P(vm->pgdir));
+  return shmaddr(id);
+}
+
+// Detach vm from segment id. Caller must hold shmtable.lock.
+static void
+shmdetach(struct vmspace *vm, int id)
+{
+  struct shmseg *s = &shmtable.seg[id];
+
+  shmunmap(vm->pgdir, s, id, s->npages);
+  vm->shm[id] = 0;
+  shmput(s);
+}
+
+// Detach the segment mapped at addr from the current process.
+int
+shmdt(char *addr)
+{
+  struct vmspace *vm = myproc()->vm;
+  struct shmseg *s;
+  uint off;
+  int id;
+
+  off = (uint)addr - SHMBASE;
+  if((uint)addr < SHMBASE || off % (SHMMAXPAGES*PGSIZE) != 0)
+    return -1;
+  id = off / (SHMMAXPAGES*PGSIZE);
+  if(id >= NSHM)
+    return -1;
+  acquiresleep(&vm->lock);
+  acquire(&shmtable.lock);
+  if(!vm->shm[id]){
+    release(&shmtable.lock);
+    releasesleep(&vm->lock);
+    return -1;
+  }
+  s = &shmtable.seg[id];
+  shmunmap(vm->pgdir, s, id, s->npages);
+  vm->shm[id] = 0;
+  release(&shmtable.lock);
+
+  // Other threads may still have the pages in their TLBs;
+  // flush them before the frames can be freed.
+  tlbflush(vm);
+  acquire(&shmtable.lock);
+  shmput(s);
+  release(&shmtable.lock);
+  releasesleep(&vm->lock);
+  return 0;
+}
+
+// Attach child to every segment parent has attached.
+// On failure the child ends up with no segments.
+int
+shmfork(struct vmspace *parent, struct vmspace *child)
+{
+  int id;
+
+  acquire(&shmtable.lock);
+  for(id = 0; id < NSHM; id++){
+    if(!parent->shm[id])
+      continue;
+    if(shmmap(child->pgdir, &shmtable.seg[id], id) < 0){
+      while(--id >= 0)
+        if(child->shm[id])
+          shmdetach(child, id);
+      release(&shmtable.lock);
+      return -1;
+    }
+    shmtable.seg[id].refcnt++;
+    child->shm[id] = 1;
+  }
+  release(&shmtable.lock);
+  return 0;
+}
+
+// Detach vm from all its segments. Called when the last
+// thread using vm is done with it, before vm->pgdir is freed.
+void
+shmexit(struct vmspace *vm)
+{
+  int id;
+
+  acquire(&shmtable.lock);
+  for(id = 0; id < NSHM; id++)
+    if(vm->shm[id])
+      shmdetach(vm, id);
+  release(&shmtable.lock);
+}
@@ -0,0 +1,58 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+
+#define PAGESIZE 4096
+#define NPAGES   64
+#define KEY      42
+
+// Parent and child exchange NPAGES pages through a shared
+// segment: the child fills it in, the parent checks it.
+int
+main(int argc, char *argv[])
+{
+  int id, pid, i;
+  char *mem;
+
+  printf(1, "\n   ***Testing shared memory***\n");
+
+  if((id = shmget(KEY, NPAGES*PAGESIZE)) < 0){
+    printf(1, "shmget failed\n");
+    exit();
+  }
+  if((mem = shmat(id)) == 0){
+    printf(1, "shmat failed\n");
+    exit();
+  }
+  if(shmget(KEY, PAGESIZE) != id){
+    printf(1, "shmget did not find segment by key\n");
+    exit();
+  }
+
+  pid = fork();
+  if(pid < 0){
+    printf(1, "fork failed\n");
+    exit();
+  }
+  if(pid == 0){
+    // The child inherits the mapping from fork().
+    for(i = 0; i < NPAGES*PAGESIZE; i++)
+      mem[i] = (char)(i % 251);
+    shmdt(mem);
+    exit();
+  }
+  wait();
+
+  for(i = 0; i < NPAGES*PAGESIZE; i++){
+    if(mem[i] != (char)(i % 251)){
+      printf(1, "shared data mismatch at %d\n", i);
+      exit();
+    }
+  }
+  if(shmdt(mem) < 0 || shmdt(mem) == 0){
+    printf(1, "shmdt failed\n");
+    exit();
+  }
+  printf(1, "%d pages shared between processes: ok\n", NPAGES);
+  exit();
+}
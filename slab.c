@@ -0,0 +1,237 @@
+// Slab allocator for small kernel objects.
+//
+// A cache hands out objects of one size. Its memory comes from
+// kallocpages() in slabs of 2^order pages; each slab starts with
+// a header, followed by an index stack of its free objects and
+// then the objects themselves. Because buddy blocks are aligned
+// to their size, the slab of an object is found by rounding its
+// address down.
+//
+// The optional constructor runs once, when an object's slab is
+// allocated, not on every kmcache_alloc(): callers must free
+// objects in their constructed state (e.g. with locks released).
+// Free objects are never written to, so that state survives.
+//
+// Each CPU keeps a small magazine of free objects per cache, so
+// most allocations and frees touch neither the cache lock nor
+// another CPU's cache lines.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "memlayout.h"
+#include "mmu.h"
+#include "x86.h"
+#include "proc.h"
+#include "spinlock.h"
+
+#define NKMCACHE   16  // maximum number of caches
+#define KMMAGSIZE  16  // objects in a per-CPU magazine
+#define KMMINOBJS   8  // objects a slab should hold at least
+
+struct slab {
+  struct kmcache *cache;
+  struct slab *next;     // in cache->slabs, if not full
+  struct slab *prev;
+  int inuse;             // objects allocated (or in a magazine)
+  int nfree;             // entries in freeidx
+  ushort freeidx[];      // indices of free objects
+};
+
+struct kmmag {
+  int n;
+  void *obj[KMMAGSIZE];
+};
+
+struct kmcache {
+  struct spinlock lock;
+  char *name;
+  uint size;             // object size, rounded up to 4 bytes
+  void (*ctor)(void*);
+  int order;             // slabs are 2^order pages
+  int nobj;              // objects per slab
+  uint objoff;           // offset of the first object in a slab
+  struct slab *slabs;    // slabs with free objects
+  int nempty;            // slabs with no objects in use
+  struct kmmag mag[NCPU];
+};
+
+struct {
+  struct spinlock lock;
+  struct kmcache cache[NKMCACHE];
+  int n;
+} kmtable;
+
+void
+slabinit(void)
+{
+  initlock(&kmtable.lock, "kmtable");
+}
+
+// Create a cache of objects of the given size.
+// Returns 0 if no cache is left or the objects are too large.
+struct kmcache*
+kmcache_create(char *name, uint size, void (*ctor)(void*))
+{
+  struct kmcache *c;
+  uint slabsize;
+  int order, n;
+
+  size = (size + 3) & ~3;
+  for(order = 0; order <= MAXORDER; order++){
+    slabsize = PGSIZE << order;
+    n = (slabsize - sizeof(struct slab)) / (size + sizeof(ushort));
+    if(n >= KMMINOBJS)
+      break;
+  }
+  if(order > MAXORDER || n > 0xFFFF)
+    return 0;
+
+  acquire(&kmtable.lock);
+  if(kmtable.n == NKMCACHE){
+    release(&kmtable.lock);
+    return 0;
+  }
+  c = &kmtable.cache[kmtable.n++];
+  release(&kmtable.lock);
+
+  memset(c, 0, sizeof(*c));
+  initlock(&c->lock, name);
+  c->name = name;
+  c->size = size;
+  c->ctor = ctor;
+  c->order = order;
+  c->nobj = n;
+  c->objoff = slabsize - n*size;
+  return c;
+}
+
+static struct slab*
+objslab(struct kmcache *c, void *obj)
+{
+  return (struct slab*)((uint)obj & ~((PGSIZE << c->order) - 1));
+}
+
+static void
+linkslab(struct kmcache *c, struct slab *s)
+{
+  s->prev = 0;
+  s->next = c->slabs;
+  if(s->next)
+    s->next->prev = s;
+  c->slabs = s;
+}
+
+static void
+unlinkslab(struct kmcache *c, struct slab *s)
+{
+  if(s->prev)
+    s->prev->next = s->next;
+  else
+    c->slabs = s->next;
+  if(s->next)
+    s->next->prev = s->prev;
+}
+
+// Allocate and construct a new slab for c.
+// Caller must hold c->lock.
+static struct slab*
+growcache(struct kmcache *c)
+{
+  struct slab *s;
+  char *obj;
+  int i;
+
+  if((s = (struct slab*)kallocpages(c->order)) == 0)
+    return 0;
+  s->cache = c;
+  s->inuse = 0;
+  s->nfree = c->nobj;
+  for(i = 0; i < c->nobj; i++){
+    s->freeidx[i] = c->nobj - 1 - i;
+    obj = (char*)s + c->objoff + i*c->size;
+    if(c->ctor)
+      c->ctor(obj);
+  }
+  linkslab(c, s);
+  c->nempty++;
+  return s;
+}
+
+// Take one object from c's slabs. Caller must hold c->lock.
+static void*
+slaballoc(struct kmcache *c)
+{
+  struct slab *s;
+
+  if((s = c->slabs) == 0 && (s = growcache(c)) == 0)
+    return 0;
+  if(s->inuse++ == 0)
+    c->nempty--;
+  if(--s->nfree == 0)
+    unlinkslab(c, s);
+  return (char*)s + c->objoff + s->freeidx[s->nfree]*c->size;
+}
+
+// Return obj to its slab, releasing the slab if it is empty
+// and c has another empty one. Caller must hold c->lock.
+static void
+slabfree(struct kmcache *c, void *obj)
+{
+  struct slab *s;
+
+  s = objslab(c, obj);
+  if(s->cache != c)
+    panic("kmcache_free: wrong cache");
+  if(s->nfree++ == 0)
+    linkslab(c, s);
+  s->freeidx[s->nfree-1] = ((char*)obj - (char*)s - c->objoff) / c->size;
+  if(--s->inuse > 0)
+    return;
+  if(c->nempty > 0){
+    unlinkslab(c, s);
+    kfreepages((char*)s, c->order);
+  } else
+    c->nempty++;
+}
+
+// Allocate a constructed object from c.
+// Returns 0 if out of memory.
+void*
+kmcache_alloc(struct kmcache *c)
+{
+  struct kmmag *m;
+  void *obj;
+
+  pushcli();
+  m = &c->mag[mycpu() - cpus];
+  if(m->n == 0){
+    // Refill half the magazine.
+    acquire(&c->lock);
+    while(m->n < KMMAGSIZE/2 && (obj = slaballoc(c)) != 0)
+      m->obj[m->n++] = obj;
+    release(&c->lock);
+  }
+  obj = m->n > 0 ? m->obj[--m->n] : 0;
+  popcli();
+  return obj;
+}
+
+// Return obj, in its constructed state, to c.
+void
+kmcache_free(struct kmcache *c, void *obj)
+{
+  struct kmmag *m;
+
+  pushcli();
+  m = &c->mag[mycpu() - cpus];
+  if(m->n == KMMAGSIZE){
+    // Flush half the magazine back to the slabs.
+    acquire(&c->lock);
+    while(m->n > KMMAGSIZE/2)
+      slabfree(c, m->obj[--m->n]);
+    release(&c->lock);
+  }
+  m->obj[m->n++] = obj;
+  popcli();
+}
@@ -4,6 +4,9 @@
 #include "memlayout.h"
 #include "mmu.h"
 #include "proc.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "vmspace.h"
 #include "x86.h"
 #include "syscall.h"
 
@@ -19,7 +22,7 @@ fetchint(uint addr, int *ip)
 {
   struct proc *curproc = myproc();
 
-  if(addr >= curproc->sz || addr+4 > curproc->sz)
+  if(addr >= curproc->vm->sz || addr+4 > curproc->vm->sz)
     return -1;
   *ip = *(int*)(addr);
   return 0;
@@ -34,10 +37,10 @@ fetchstr(uint addr, char **pp)
   char *s, *ep;
   struct proc *curproc = myproc();
 
-  if(addr >= curproc->sz)
+  if(addr >= curproc->vm->sz)
     return -1;
   *pp = (char*)addr;
-  ep = (char*)curproc->sz;
+  ep = (char*)curproc->vm->sz;
   for(s = *pp; s < ep; s++){
     if(*s == 0)
       return s - *pp;
@@ -63,7 +66,7 @@ argptr(int n, char **pp, int size)
  
   if(argint(n, &i) < 0)
     return -1;
-  if(size < 0 || (uint)i >= curproc->sz || (uint)i+size > curproc->sz)
+  if(size < 0 || (uint)i >= curproc->vm->sz || (uint)i+size > curproc->vm->sz)
     return -1;
   *pp = (char*)i;
   return 0;
@@ -105,6 +108,19 @@ extern int sys_write(void);
 extern int sys_uptime(void);
 extern int sys_printStats(void);
 extern int sys_procDump(void);
+extern int sys_shmget(void);
+extern int sys_shmat(void);
+extern int sys_shmdt(void);
+extern int sys_mlock(void);
+extern int sys_munlock(void);
+extern int sys_madvise(void);
+extern int sys_setpriority(void);
+extern int sys_clone(void);
+extern int sys_join(void);
+extern int sys_sched_setaffinity(void);
+extern int sys_getcpustat(void);
+extern int sys_getprocstat(void);
+extern int sys_getbcstat(void);
 
 static int (*syscalls[])(void) = {
 [SYS_fork]    sys_fork,
@@ -130,6 +146,19 @@ static int (*syscalls[])(void) = {
 [SYS_close]   sys_close,
 [SYS_printStats]  sys_printStats,
 [SYS_procDump]    sys_procDump,
+[SYS_shmget]  sys_shmget,
+[SYS_shmat]   sys_shmat,
+[SYS_shmdt]   sys_shmdt,
+[SYS_mlock]   sys_mlock,
+[SYS_munlock] sys_munlock,
+[SYS_madvise] sys_madvise,
+[SYS_setpriority] sys_setpriority,
+[SYS_clone]   sys_clone,
+[SYS_join]    sys_join,
+[SYS_sched_setaffinity] sys_sched_setaffinity,
+[SYS_getcpustat] sys_getcpustat,
+[SYS_getprocstat] sys_getprocstat,
+[SYS_getbcstat] sys_getbcstat,
 };
 
 void
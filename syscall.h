@@ -21,4 +21,17 @@
 #define SYS_mkdir  20
 #define SYS_close  21
 #define SYS_printStats  22 
-#define SYS_procDump  23
\ No newline at end of file
+#define SYS_procDump  23
+#define SYS_shmget 24
+#define SYS_shmat  25
+#define SYS_shmdt  26
+#define SYS_mlock  27
+#define SYS_munlock 28
+#define SYS_madvise 29
+#define SYS_setpriority 30
+#define SYS_clone 31
+#define SYS_join 32
+#define SYS_sched_setaffinity 33
+#define SYS_getcpustat 34
+#define SYS_getprocstat 35
+#define SYS_getbcstat 36
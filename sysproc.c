@@ -6,6 +6,10 @@
 #include "memlayout.h"
 #include "mmu.h"
 #include "proc.h"
+#include "timer.h"
+#include "cpustat.h"
+#include "pstat.h"
+#include "bcstat.h"
 
 int 
 sys_procDump(void)
@@ -41,6 +45,26 @@ sys_wait(void)
   return wait();
 }
 
+int
+sys_clone(void)
+{
+  int fn, arg, stack;
+
+  if(argint(0, &fn) < 0 || argint(1, &arg) < 0 || argint(2, &stack) < 0)
+    return -1;
+  return clone((void(*)(void*))fn, (void*)arg, (void*)stack);
+}
+
+int
+sys_join(void)
+{
+  void **stack;
+
+  if(argptr(0, (void*)&stack, sizeof(*stack)) < 0)
+    return -1;
+  return join(stack);
+}
+
 int
 sys_kill(void)
 {
@@ -51,6 +75,73 @@ sys_kill(void)
   return kill(pid);
 }
 
+int
+sys_setpriority(void)
+{
+  int pid, prio;
+
+  if(argint(0, &pid) < 0 || argint(1, &prio) < 0)
+    return -1;
+  return setpriority(pid, prio);
+}
+
+int
+sys_sched_setaffinity(void)
+{
+  int pid, mask;
+
+  if(argint(0, &pid) < 0 || argint(1, &mask) < 0)
+    return -1;
+  return sched_setaffinity(pid, mask);
+}
+
+int
+sys_getcpustat(void)
+{
+  struct cpustat *st;
+  int n;
+
+  if(argint(1, &n) < 0 || n < 0)
+    return -1;
+  if(n > NCPU)
+    n = NCPU;
+  if(argptr(0, (void*)&st, n*sizeof(*st)) < 0)
+    return -1;
+  return getcpustat(st, n);
+}
+
+// Processes are listed under ptable.lock, where a fault on a
+// swapped-out user page cannot be served, so go through a
+// kernel page.
+int
+sys_getprocstat(void)
+{
+  struct procstat *ps, *buf;
+  int n;
+
+  if(argint(1, &n) < 0 || n < 0)
+    return -1;
+  if(n > PGSIZE / sizeof(*ps))
+    n = PGSIZE / sizeof(*ps);
+  if(argptr(0, (void*)&ps, n*sizeof(*ps)) < 0 || (buf = (struct procstat*)kalloc()) == 0)
+    return -1;
+  n = getprocstat(buf, n);
+  memmove(ps, buf, n*sizeof(*ps));
+  kfree((char*)buf);
+  return n;
+}
+
+int
+sys_getbcstat(void)
+{
+  struct bcstat *st;
+
+  if(argptr(0, (void*)&st, sizeof(*st)) < 0)
+    return -1;
+  bcachestat(st);
+  return 0;
+}
+
 int
 sys_getpid(void)
 {
@@ -65,8 +156,7 @@ sys_sbrk(void)
 
   if(argint(0, &n) < 0)
     return -1;
-  addr = myproc()->sz;
-  if(growproc(n) < 0)
+  if((addr = growproc(n)) < 0)
     return -1;
   return addr;
 }
@@ -75,23 +165,91 @@ int
 sys_sleep(void)
 {
   int n;
-  uint ticks0;
+  struct timer t;
 
   if(argint(0, &n) < 0)
     return -1;
+  if(n <= 0)
+    return 0;
+  // Sleep on our own timer, so only its expiry wakes us.
+  timersync();
   acquire(&tickslock);
-  ticks0 = ticks;
-  while(ticks - ticks0 < n){
+  t.pprev = 0;
+  t.fn = wakeup;
+  t.arg = &t;
+  timeradd(&t, ticks + n);
+  while(t.pprev){
     if(myproc()->killed){
+      timerdel(&t);
       release(&tickslock);
       return -1;
     }
-    sleep(&ticks, &tickslock);
+    sleep(&t, &tickslock);
   }
   release(&tickslock);
   return 0;
 }
 
+int
+sys_shmget(void)
+{
+  int key, size;
+
+  if(argint(0, &key) < 0 || argint(1, &size) < 0)
+    return -1;
+  return shmget(key, size);
+}
+
+int
+sys_shmat(void)
+{
+  int id;
+
+  if(argint(0, &id) < 0)
+    return -1;
+  return (int)shmat(id);
+}
+
+int
+sys_shmdt(void)
+{
+  int addr;
+
+  if(argint(0, &addr) < 0)
+    return -1;
+  return shmdt((char*)addr);
+}
+
+int
+sys_mlock(void)
+{
+  int addr, len;
+
+  if(argint(0, &addr) < 0 || argint(1, &len) < 0)
+    return -1;
+  return mlock((char*)addr, len);
+}
+
+int
+sys_munlock(void)
+{
+  int addr, len;
+
+  if(argint(0, &addr) < 0 || argint(1, &len) < 0)
+    return -1;
+  return munlock((char*)addr, len);
+}
+
+int
+sys_madvise(void)
+{
+  int addr, len, advice;
+
+  if(argint(0, &addr) < 0 || argint(1, &len) < 0 || argint(2, &advice) < 0)
+    return -1;
+  return madvise((char*)addr, len, advice);
+}
+
 // return how many clock tick interrupts have occurred
 // since start.
 int
@@ -99,6 +257,7 @@ sys_uptime(void)
 {
   uint xticks;
 
+  timersync();
   acquire(&tickslock);
   xticks = ticks;
   release(&tickslock);
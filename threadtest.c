@@ -0,0 +1,91 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "fcntl.h"
+
+#define PAGESIZE 4096
+#define NTHREAD  4
+#define NPAGES   14
+#define NROUND   8
+
+char *mem;
+int fd = -1;
+
+// Each thread owns every NTHREAD-th page of mem. There are more
+// pages than fit in memory, so the threads keep swapping out
+// each other's pages while they write and check their own.
+void
+worker(void *arg)
+{
+  int id = (int)arg;
+  int r, i;
+
+  for(r = 0; r < NROUND; r++){
+    for(i = id; i < NPAGES; i += NTHREAD)
+      mem[i*PAGESIZE + r] = i + r;
+    for(i = id; i < NPAGES; i += NTHREAD){
+      if(mem[i*PAGESIZE + r] != (char)(i + r)){
+        printf(1, "thread %d: page %d lost its contents\n", id, i);
+        exit();
+      }
+    }
+  }
+  exit();
+}
+
+// Open a file for the main thread to use.
+void
+opener(void *arg)
+{
+  fd = open("threadtest.tmp", O_CREATE|O_RDWR);
+  exit();
+}
+
+int
+main(int argc, char *argv[])
+{
+  char *stacks;
+  void *stack;
+  int i, r, n;
+
+  printf(1, "\n   ***Testing threads***\n");
+
+  stacks = sbrk(NTHREAD*PAGESIZE);
+  mem = sbrk(NPAGES*PAGESIZE);
+
+  // Open files are shared.
+  if(clone(opener, 0, stacks) < 0 || join(&stack) < 0 || stack != stacks){
+    printf(1, "clone/join failed\n");
+    exit();
+  }
+  if(fd < 0 || write(fd, "x", 1) != 1){
+    printf(1, "file opened by a thread is not shared\n");
+    exit();
+  }
+  close(fd);
+  unlink("threadtest.tmp");
+
+  // So is the address space, paging state included.
+  for(i = 0; i < NTHREAD; i++){
+    if(clone(worker, (void*)i, stacks + i*PAGESIZE) < 0){
+      printf(1, "clone failed\n");
+      exit();
+    }
+  }
+  for(n = 0; join(&stack) > 0; n++)
+    ;
+  if(n != NTHREAD || wait() != -1){
+    printf(1, "join found %d threads\n", n);
+    exit();
+  }
+  for(i = 0; i < NPAGES; i++){
+    for(r = 0; r < NROUND; r++){
+      if(mem[i*PAGESIZE + r] != (char)(i + r)){
+        printf(1, "page %d lost its contents\n", i);
+        exit();
+      }
+    }
+  }
+  printf(1, "%d threads shared %d pages: ok\n", NTHREAD, NPAGES);
+  exit();
+}
@@ -0,0 +1,37 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+
+#define NROUND  5
+#define NTICKS  10
+#define SLACK   3
+
+// Sleep on CPU 1 while CPU 0, which keeps time, has nothing
+// to run and is idle without its tick: the timer must still
+// wake us on time, and uptime() must still advance.
+int
+main(int argc, char *argv[])
+{
+  int i, start, elapsed, old;
+
+  printf(1, "\n   ***Testing timers during tickless idle***\n");
+
+  if((old = sched_setaffinity(getpid(), 2)) < 0){
+    printf(1, "only one CPU, skipping\n");
+    exit();
+  }
+  for(i = 0; i < NROUND; i++){
+    // Let CPU 0 settle into idle first.
+    sleep(NTICKS);
+    start = uptime();
+    sleep(NTICKS);
+    elapsed = uptime() - start;
+    if(elapsed < NTICKS || elapsed > NTICKS + SLACK){
+      printf(1, "sleep(%d) took %d ticks\n", NTICKS, elapsed);
+      exit();
+    }
+  }
+  sched_setaffinity(getpid(), old);
+  printf(1, "%d sleeps of %d ticks on cpu 1: ok\n", NROUND, NTICKS);
+  exit();
+}
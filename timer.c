@@ -0,0 +1,160 @@
+// Hierarchical timer wheel.
+//
+// Pending timers hang off four wheels of slots. tv1 has a slot
+// for each of the next 256 ticks; a slot of tv2 covers 256 ticks,
+// one of tv3 2^14 and one of tv4 2^20. Each time tv1 wraps, the
+// next slot of tv2 is cascaded: its timers are redistributed into
+// tv1, and likewise for the outer wheels. Adding and deleting a
+// timer is O(1), and a tick only touches the timers that expire
+// on it, plus the occasional cascade.
+//
+// All timer state is protected by tickslock, which callers of
+// timeradd() and timerdel() must hold. Expired timers are
+// unlinked before their fn runs, so fn may re-add its timer.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "spinlock.h"
+#include "timer.h"
+
+#define TVR_BITS  8
+#define TVN_BITS  6
+#define TVR_SIZE  (1 << TVR_BITS)
+#define TVN_SIZE  (1 << TVN_BITS)
+#define TVR_MASK  (TVR_SIZE - 1)
+#define TVN_MASK  (TVN_SIZE - 1)
+#define MAXDELAY  ((1 << (TVR_BITS + 3*TVN_BITS)) - 1)
+
+struct {
+  uint now;                 // next tick to process
+  struct timer *tv1[TVR_SIZE];
+  struct timer *tv2[TVN_SIZE];
+  struct timer *tv3[TVN_SIZE];
+  struct timer *tv4[TVN_SIZE];
+} wheel;
+
+void
+timerinit(void)
+{
+  wheel.now = ticks;
+}
+
+// Put t in the slot its expiry falls into.
+static void
+timerlink(struct timer *t)
+{
+  struct timer **slot;
+  uint e = t->expires;
+  int delay = e - wheel.now;
+
+  if(delay < 0)
+    slot = &wheel.tv1[wheel.now & TVR_MASK];  // already due
+  else if(delay < TVR_SIZE)
+    slot = &wheel.tv1[e & TVR_MASK];
+  else if(delay < 1 << (TVR_BITS + TVN_BITS))
+    slot = &wheel.tv2[(e >> TVR_BITS) & TVN_MASK];
+  else if(delay < 1 << (TVR_BITS + 2*TVN_BITS))
+    slot = &wheel.tv3[(e >> (TVR_BITS + TVN_BITS)) & TVN_MASK];
+  else {
+    if(delay > MAXDELAY)
+      t->expires = e = wheel.now + MAXDELAY;
+    slot = &wheel.tv4[(e >> (TVR_BITS + 2*TVN_BITS)) & TVN_MASK];
+  }
+  t->next = *slot;
+  if(t->next)
+    t->next->pprev = &t->next;
+  t->pprev = slot;
+  *slot = t;
+}
+
+static void
+timerunlink(struct timer *t)
+{
+  *t->pprev = t->next;
+  if(t->next)
+    t->next->pprev = t->pprev;
+  t->next = 0;
+  t->pprev = 0;
+}
+
+// Arrange for t->fn(t->arg) to run at tick expires.
+// Caller must hold tickslock.
+void
+timeradd(struct timer *t, uint expires)
+{
+  if(!holding(&tickslock))
+    panic("timeradd");
+  if(t->pprev)
+    timerunlink(t);
+  t->expires = expires;
+  timerlink(t);
+  timerwake(expires);
+}
+
+// Cancel t. Return 1 if it was pending, 0 if it had
+// already run or was never added.
+// Caller must hold tickslock.
+int
+timerdel(struct timer *t)
+{
+  if(!holding(&tickslock))
+    panic("timerdel");
+  if(t->pprev == 0)
+    return 0;
+  timerunlink(t);
+  return 1;
+}
+
+// Return the earliest tick with a timer due, looking no further
+// than the next time tv1 wraps, when timertick() must cascade.
+// Caller must hold tickslock.
+uint
+timernext(void)
+{
+  uint t;
+
+  for(t = wheel.now; wheel.tv1[t & TVR_MASK] == 0; t++)
+    if(((t + 1) & TVR_MASK) == 0)
+      return t + 1;
+  return t;
+}
+
+// Move the timers of one outer-wheel slot down the wheels.
+// Return the slot's index, so the caller knows whether the
+// next wheel out has wrapped too.
+static int
+cascade(struct timer **tv, int index)
+{
+  struct timer *t, *next;
+
+  t = tv[index];
+  tv[index] = 0;
+  for(; t; t = next){
+    next = t->next;
+    timerlink(t);
+  }
+  return index;
+}
+
+// Run the timers that have expired by ticks.
+// Called from the timer interrupt with tickslock held.
+void
+timertick(void)
+{
+  struct timer *t;
+  int index;
+
+  while((int)(ticks - wheel.now) >= 0){
+    index = wheel.now & TVR_MASK;
+    if(index == 0 &&
+       cascade(wheel.tv2, (wheel.now >> TVR_BITS) & TVN_MASK) == 0 &&
+       cascade(wheel.tv3, (wheel.now >> (TVR_BITS + TVN_BITS)) & TVN_MASK) == 0)
+      cascade(wheel.tv4, (wheel.now >> (TVR_BITS + 2*TVN_BITS)) & TVN_MASK);
+    wheel.now++;
+    while((t = wheel.tv1[index]) != 0){
+      timerunlink(t);
+      t->fn(t->arg);
+    }
+  }
+}
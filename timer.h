@@ -0,0 +1,10 @@
+// Kernel timer, run from the timer interrupt once ticks
+// reaches expires. Embed one wherever a timeout is needed;
+// see timer.c.
+struct timer {
+  struct timer *next;
+  struct timer **pprev;   // 0 if not pending
+  uint expires;           // tick at which to run fn
+  void (*fn)(void*);      // called with tickslock held
+  void *arg;
+};
@@ -0,0 +1,106 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "cpustat.h"
+#include "pstat.h"
+#include "bcstat.h"
+
+#define NCPU      8
+#define NPS       64
+#define INTERVAL  100   // ticks between samples
+#define SHIFT     10    // scale cycle counts down to fit 32-bit math
+
+struct cpustat cpu0[NCPU], cpu1[NCPU];
+struct procstat ps0[NPS], ps1[NPS];
+struct procstat none;    // previous sample of a new process
+struct bcstat bc0, bc1;
+
+char *states[] = { "unused", "embryo", "sleep ", "runble", "run   ", "zombie" };
+
+// Cycles from a to b, scaled down by SHIFT.
+uint
+delta(uint64 a, uint64 b)
+{
+  return (uint)((b - a) >> SHIFT);
+}
+
+// Find pid among the n entries of ps, or return 0.
+struct procstat*
+findps(struct procstat *ps, int n, int pid)
+{
+  int i;
+
+  for(i = 0; i < n; i++)
+    if(ps[i].pid == pid)
+      return &ps[i];
+  return 0;
+}
+
+// Print what happened between two samples: per CPU, the share
+// of time it ran processes, its switches and migrations and the
+// mean cost of a switch; for the buffer cache, its size and
+// lookups; per process, its share of one CPU spent
+// running and waiting to run, and its context switches.
+void
+report(int ncpu, int n0, int n1)
+{
+  struct procstat *p, *q;
+  uint busy, total, cycles, span;
+  int i;
+
+  span = 0;
+  printf(1, "\nCPU  BUSY%%  SWITCH  MIGRATE  CYCLES/SWITCH\n");
+  for(i = 0; i < ncpu; i++){
+    busy = delta(cpu0[i].busytime, cpu1[i].busytime);
+    total = busy + delta(cpu0[i].idletime, cpu1[i].idletime);
+    cycles = cpu1[i].nswitch - cpu0[i].nswitch;
+    if(cycles)
+      cycles = (uint)(cpu1[i].swtchtime - cpu0[i].swtchtime) / cycles;
+    printf(1, "%d    %d      %d      %d        %d\n", i,
+           total ? busy*100/total : 0, cpu1[i].nswitch - cpu0[i].nswitch,
+           cpu1[i].nmigrate - cpu0[i].nmigrate, cycles);
+    if(total > span)
+      span = total;
+  }
+
+  printf(1, "\nbuffer cache: %d/%d buffers, %d hits, %d misses\n",
+         bc1.nbuf, bc1.maxbuf, bc1.hits - bc0.hits, bc1.misses - bc0.misses);
+
+  printf(1, "\nPID  STATE   CPU  RUN%%  WAIT%%  VCSW  IVCSW  NAME\n");
+  for(i = 0; i < n1; i++){
+    p = &ps1[i];
+    if((q = findps(ps0, n0, p->pid)) == 0)
+      q = &none;
+    printf(1, "%d    %s  %d    %d     %d      %d     %d      %s\n",
+           p->pid, p->state >= 0 && p->state < 6 ? states[p->state] : "???", p->cpu,
+           span ? delta(q->runtime, p->runtime)*100/span : 0,
+           span ? delta(q->waittime, p->waittime)*100/span : 0,
+           p->nvcsw - q->nvcsw, p->nivcsw - q->nivcsw, p->name);
+  }
+}
+
+// top [rounds]: sample scheduling statistics every INTERVAL
+// ticks and print the changes, rounds times (default 1).
+int
+main(int argc, char *argv[])
+{
+  int rounds, ncpu, n0, n1;
+
+  rounds = argc > 1 ? atoi(argv[1]) : 1;
+  if((ncpu = getcpustat(cpu1, NCPU)) > NCPU)
+    ncpu = NCPU;
+  n1 = getprocstat(ps1, NPS);
+  getbcstat(&bc1);
+  while(rounds-- > 0){
+    memmove(cpu0, cpu1, sizeof(cpu0));
+    memmove(ps0, ps1, sizeof(ps0));
+    n0 = n1;
+    bc0 = bc1;
+    sleep(INTERVAL);
+    getcpustat(cpu1, NCPU);
+    getbcstat(&bc1);
+    n1 = getprocstat(ps1, NPS);
+    report(ncpu, n0, n1);
+  }
+  exit();
+}
@@ -7,6 +7,8 @@
 #include "x86.h"
 #include "traps.h"
 #include "spinlock.h"
+#include "sleeplock.h"
+#include "vmspace.h"
 
 // Interrupt descriptor table (shared by all CPUs).
 struct gatedesc idt[256];
@@ -32,6 +34,67 @@ idtinit(void)
   lidt(idt, sizeof(idt));
 }
 
+// Leave tickless idle: restart this CPU's periodic timer and,
+// on CPU 0, account for the ticks that passed while it was off.
+// Called with interrupts disabled.
+void
+timerresume(void)
+{
+  struct cpu *c = mycpu();
+  uint n;
+
+  if(!c->tickless)
+    return;
+  c->tickless = 0;
+  n = lapicperiodic();
+  if(c == &cpus[0] && n > 0){
+    acquire(&tickslock);
+    #if NFU
+      updateNFUState(n);
+    #endif
+    ticks += n;
+    timertick();
+    release(&tickslock);
+  }
+  c->nresume++;
+}
+
+// A timer was added for tick expires. If CPU 0 is in tickless
+// idle with its one-shot set for later, interrupt it, so that
+// it catches up and sets the one-shot again.
+// Caller must hold tickslock.
+void
+timerwake(uint expires)
+{
+  struct cpu *c = &cpus[0];
+
+  if(c->tickless && (int)(expires - c->deadline) < 0 && mycpu() != c)
+    lapicipi(c->apicid, T_IRQ0 + IRQ_RESCHED);
+}
+
+// Bring ticks up to date. While CPU 0 is in tickless idle,
+// ticks stands still, so make it catch up and wait until it
+// has. Caller must not hold tickslock, nor any lock a timer
+// function takes.
+void
+timersync(void)
+{
+  struct cpu *c = &cpus[0];
+  uint gen;
+
+  pushcli();
+  if(mycpu() != c){
+    gen = c->nresume;
+    __sync_synchronize();
+    if(c->tickless){
+      lapicipi(c->apicid, T_IRQ0 + IRQ_RESCHED);
+      while(c->nresume == gen)
+        ;
+    }
+  }
+  popcli();
+}
+
 //PAGEBREAK: 41
 void
 trap(struct trapframe *tf)
@@ -50,19 +113,30 @@ trap(struct trapframe *tf)
 
   switch(tf->trapno){
   case T_IRQ0 + IRQ_TIMER:
-    if(cpuid() == 0){
+    if(mycpu()->tickless)
+      timerresume();  // counts this tick too
+    else if(cpuid() == 0){
       acquire(&tickslock);
 
       #if NFU
-        updateNFUState();
+        updateNFUState(1);
       #endif
 
       ticks++;
-      wakeup(&ticks);
+      timertick();
       release(&tickslock);
     }
     lapiceoi();
     break;
+  case T_IRQ0 + IRQ_RESCHED:
+    // Only needed to wake an idle CPU from hlt.
+    lapiceoi();
+    break;
+  case T_IRQ0 + IRQ_TLB:
+    lcr3(rcr3());
+    mycpu()->tlbgen++;
+    lapiceoi();
+    break;
   case T_IRQ0 + IRQ_IDE:
     ideintr();
     lapiceoi();
@@ -87,18 +161,27 @@ trap(struct trapframe *tf)
 
   case T_PGFLT:
     addr = rcr2();
-    vaddr = &(myproc()->pgdir[PDX(addr)]);
+    vaddr = &(myproc()->vm->pgdir[PDX(addr)]);
     if(((int)(*vaddr) & PTE_P)!=0){
       if(((uint*)PTE_ADDR(P2V(*vaddr)))[PTX(addr)] & PTE_PG){
         //cprintf("called T_PGFLT\n");
-        swapPages(PTE_ADDR(addr));
-        ++myproc()->page_fault_count;
-        return;
+        // If the page cannot come back, a user process is killed
+        // on the way out. The kernel cannot skip the access that
+        // faulted, and retrying it would fault forever.
+        if(swapPages(PTE_ADDR(addr)) < 0 && (tf->cs&3) == 0)
+          panic("trap: cannot page in user memory for kernel");
+        break;
       }
     }
 
   //PAGEBREAK: 13
   default:
+    // The virtio disk's interrupt line is set by the BIOS.
+    if(virtioirq && tf->trapno == T_IRQ0 + virtioirq){
+      virtiointr();
+      lapiceoi();
+      break;
+    }
     if(myproc() == 0 || (tf->cs&3) == 0){
       // In kernel, it must be our mistake.
       cprintf("unexpected trap %d from cpu %d eip %x (cr2=0x%x)\n",
@@ -123,7 +206,7 @@ trap(struct trapframe *tf)
   // If interrupts were on while locks held, would need to check nlock.
   if(myproc() && myproc()->state == RUNNING &&
      tf->trapno == T_IRQ0+IRQ_TIMER)
-    yield();
+    schedtick();
 
   // Check if the process has been killed since we yielded
   if(myproc() && myproc()->killed && (tf->cs&3) == DPL_USER)
@@ -34,5 +34,7 @@
 #define IRQ_COM1         4
 #define IRQ_IDE         14
 #define IRQ_ERROR       19
+#define IRQ_TLB         29      // IPI: flush the TLB; see tlbflush()
+#define IRQ_RESCHED     30      // IPI: work was queued for an idle CPU
 #define IRQ_SPURIOUS    31
 
@@ -1,4 +1,7 @@
 struct stat;
+struct cpustat;
+struct procstat;
+struct bcstat;
 struct rtcdate;
 
 // system calls
@@ -25,6 +28,19 @@ int sleep(int);
 int uptime(void);
 int printStats(void);
 int procDump(void);
+int shmget(int, int);
+char* shmat(int);
+int shmdt(char*);
+int mlock(void*, uint);
+int munlock(void*, uint);
+int madvise(void*, uint, int);
+int setpriority(int, int);
+int clone(void(*)(void*), void*, void*);
+int join(void**);
+int sched_setaffinity(int, uint);
+int getcpustat(struct cpustat*, int);
+int getprocstat(struct procstat*, int);
+int getbcstat(struct bcstat*);
 
 // ulib.c
 int stat(const char*, struct stat*);
@@ -0,0 +1,275 @@
+// Driver for a legacy virtio-blk PCI device.
+//
+// When QEMU provides one (make DISK=virtio), the device serves
+// disk ROOTDEV in place of IDE disk 1, so the file system and
+// the swap files on it use it; without one, everything stays
+// on the IDE driver. bio.c picks the driver with virtiodisk().
+//
+// Unlike IDE, the device takes many requests at once. Each buf
+// becomes a chain of three descriptors in the virtqueue (header,
+// data, status), and the host completes chains in any order,
+// reporting them in the used ring. Bufs that find no free
+// descriptors wait in vwaitq until a completion frees some.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "memlayout.h"
+#include "mmu.h"
+#include "proc.h"
+#include "x86.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "buf.h"
+#include "pci.h"
+#include "virtio.h"
+
+#define SECTOR_SIZE  512
+#define VQMAX        256  // largest queue size supported
+
+int virtioirq;            // interrupt line, 0 if there is no device
+
+// You must hold vlock while manipulating the queue.
+static struct spinlock vlock;
+static ushort vbase;      // I/O base, 0 if there is no device
+static uint vqsize;       // descriptors in the queue
+static uint vnsect;       // disk size in sectors
+static struct vring_desc *vdesc;
+static struct vring_avail *vavail;
+static struct vring_used *vused;
+static ushort vfree;      // free descriptors, linked through next
+static uint nvfree;
+static ushort vlastused;  // used ring entries already handled
+static struct buf *vwaitq;
+
+// Per-request state, indexed by the head of its chain.
+static struct {
+  struct virtio_blk_req hdr;
+  uchar status;
+  struct buf *b;
+} vreq[VQMAX];
+
+void
+virtioinit(void)
+{
+  struct pcidev pci;
+  uint size, usedoff, ringsz;
+  ushort base;
+  char *ring;
+  int order, i;
+
+  if(pcifind(&pci, VIRTIO_VENDOR, VIRTIO_DEV_BLK, PCI_ANY, PCI_ANY) < 0 ||
+     !(pci.bar[0] & PCI_BAR_IO) || pci.irq == 0 || pci.irq == 0xFF)
+    return;
+  pcienable(&pci);
+  base = PCI_BAR_IOADDR(pci.bar[0]);
+
+  // Reset, then negotiate no optional features.
+  outb(base + VIRTIO_STATUS, 0);
+  outb(base + VIRTIO_STATUS, VIRTIO_ST_ACK);
+  outb(base + VIRTIO_STATUS, VIRTIO_ST_ACK|VIRTIO_ST_DRIVER);
+  outl(base + VIRTIO_GUEST_FEATURES, 0);
+
+  // The queue size is fixed by the device and must be a power
+  // of two; the ring takes whole pages.
+  outw(base + VIRTIO_QUEUE_SEL, 0);
+  size = inw(base + VIRTIO_QUEUE_SIZE);
+  usedoff = PGROUNDUP(size*sizeof(struct vring_desc) +
+                      sizeof(struct vring_avail) + (size+1)*sizeof(ushort));
+  ringsz = usedoff + PGROUNDUP(sizeof(struct vring_used) +
+                      size*sizeof(struct vring_used_elem) + sizeof(ushort));
+  for(order = 0; order < MAXORDER && (PGSIZE << order) < ringsz; order++)
+    ;
+  ring = 0;
+  if(size == 0 || size > VQMAX || (size & (size-1)) != 0 ||
+     (ring = kallocpages(order)) == 0){
+    outb(base + VIRTIO_STATUS, VIRTIO_ST_FAILED);
+    cprintf("virtio: unusable queue, using IDE\n");
+    return;
+  }
+  memset(ring, 0, PGSIZE << order);
+  vqsize = size;
+  vdesc = (struct vring_desc*)ring;
+  vavail = (struct vring_avail*)(ring + size*sizeof(struct vring_desc));
+  vused = (struct vring_used*)(ring + usedoff);
+  for(i = 0; i < size; i++)
+    vdesc[i].next = i + 1;
+  vfree = 0;
+  nvfree = size;
+  outl(base + VIRTIO_QUEUE_PFN, V2P(ring) >> PTXSHIFT);
+
+  // Blocks past 2^32 sectors are out of reach anyway.
+  vnsect = inl(base + VIRTIO_BLK_CAPACITY + 4) ? 0xFFFFFFFF :
+           inl(base + VIRTIO_BLK_CAPACITY);
+
+  initlock(&vlock, "virtio");
+  virtioirq = pci.irq;
+  ioapicenable(virtioirq, ncpu - 1);
+  outb(base + VIRTIO_STATUS, VIRTIO_ST_ACK|VIRTIO_ST_DRIVER|VIRTIO_ST_DRIVER_OK);
+  vbase = base;
+}
+
+// Is disk dev served by the virtio device?
+int
+virtiodisk(uint dev)
+{
+  return vbase != 0 && dev == ROOTDEV;
+}
+
+// Take a free descriptor. Caller must hold vlock.
+static int
+vdescalloc(void)
+{
+  int i;
+
+  i = vfree;
+  vfree = vdesc[i].next;
+  nvfree--;
+  return i;
+}
+
+// Free the chain starting at descriptor i. Caller must hold vlock.
+static void
+vdescfree(int i)
+{
+  int next, more;
+
+  for(;;){
+    next = vdesc[i].next;
+    more = vdesc[i].flags & VRING_DESC_NEXT;
+    vdesc[i].next = vfree;
+    vfree = i;
+    nvfree++;
+    if(!more)
+      break;
+    i = next;
+  }
+}
+
+// Make the request for b available to the device, without
+// notifying it. Caller must hold vlock, and three descriptors
+// must be free.
+static void
+vstart(struct buf *b)
+{
+  int h, d, s, write;
+
+  write = b->flags & B_DIRTY;
+  h = vdescalloc();
+  d = vdescalloc();
+  s = vdescalloc();
+
+  vreq[h].hdr.type = write ? VIRTIO_BLK_T_OUT : VIRTIO_BLK_T_IN;
+  vreq[h].hdr.reserved = 0;
+  vreq[h].hdr.sector = b->blockno * (BSIZE/SECTOR_SIZE);
+  vreq[h].status = 0xFF;
+  vreq[h].b = b;
+
+  vdesc[h].addr = V2P(&vreq[h].hdr);
+  vdesc[h].len = sizeof(vreq[h].hdr);
+  vdesc[h].flags = VRING_DESC_NEXT;
+  vdesc[h].next = d;
+  vdesc[d].addr = V2P(b->data);
+  vdesc[d].len = BSIZE;
+  vdesc[d].flags = VRING_DESC_NEXT | (write ? 0 : VRING_DESC_WRITE);
+  vdesc[d].next = s;
+  vdesc[s].addr = V2P(&vreq[h].status);
+  vdesc[s].len = 1;
+  vdesc[s].flags = VRING_DESC_WRITE;
+
+  vavail->ring[vavail->idx % vqsize] = h;
+  __sync_synchronize();  // ring entry before index
+  vavail->idx++;
+}
+
+// Tell the device about new requests, unless it says it
+// is still polling the ring anyway.
+static void
+vnotify(void)
+{
+  __sync_synchronize();
+  if(!(vused->flags & VRING_USED_NO_NOTIFY))
+    outw(vbase + VIRTIO_QUEUE_NOTIFY, 0);
+}
+
+// Interrupt handler.
+void
+virtiointr(void)
+{
+  struct buf *b;
+  int h, n;
+
+  acquire(&vlock);
+  inb(vbase + VIRTIO_ISR);  // ack, lowering the interrupt line
+
+  while(vlastused != *(volatile ushort*)&vused->idx){
+    __sync_synchronize();  // index before ring entry
+    h = vused->ring[vlastused % vqsize].id;
+    vlastused++;
+    b = vreq[h].b;
+    if(vreq[h].status != VIRTIO_BLK_S_OK)
+      panic("virtio: I/O error");
+    vreq[h].b = 0;
+    vdescfree(h);
+
+    // Call the buf's completion function, or wake
+    // process waiting for it.
+    b->flags |= B_VALID;
+    b->flags &= ~B_DIRTY;
+    if(b->done)
+      b->done(b);
+    else
+      wakeup(b);
+  }
+
+  // Hand the freed descriptors to bufs waiting for them.
+  for(n = 0; vwaitq && nvfree >= 3; n++){
+    b = vwaitq;
+    vwaitq = b->qnext;
+    vstart(b);
+  }
+  if(n > 0)
+    vnotify();
+
+  release(&vlock);
+}
+
+//PAGEBREAK!
+// Queue b for the disk and return without waiting, like
+// idesubmit(). Any number of requests can be outstanding.
+void
+virtiosubmit(struct buf *b)
+{
+  struct buf **pp;
+
+  if(!holdingsleep(&b->lock))
+    panic("virtiosubmit: buf not locked");
+  if((b->flags & (B_VALID|B_DIRTY)) == B_VALID)
+    panic("virtiosubmit: nothing to do");
+  if(b->blockno >= vnsect / (BSIZE/SECTOR_SIZE))
+    panic("virtiosubmit: incorrect blockno");
+
+  acquire(&vlock);
+  if(vwaitq == 0 && nvfree >= 3){
+    vstart(b);
+    vnotify();
+  } else {
+    b->qnext = 0;
+    for(pp = &vwaitq; *pp; pp = &(*pp)->qnext)
+      ;
+    *pp = b;
+  }
+  release(&vlock);
+}
+
+// Wait for the request for b, submitted without a
+// completion function, to finish.
+void
+virtioawait(struct buf *b)
+{
+  acquire(&vlock);
+  while((b->flags & (B_VALID|B_DIRTY)) != B_VALID)
+    sleep(b, &vlock);
+  release(&vlock);
+}
@@ -0,0 +1,71 @@
+// Legacy virtio over PCI, as used by virtio.c.
+// See the virtio 0.9.5 specification.
+
+#define VIRTIO_VENDOR     0x1AF4
+#define VIRTIO_DEV_BLK    0x1001  // transitional block device
+
+// Registers in the I/O space given by BAR0
+#define VIRTIO_HOST_FEATURES   0x00
+#define VIRTIO_GUEST_FEATURES  0x04
+#define VIRTIO_QUEUE_PFN       0x08  // physical page of the ring
+#define VIRTIO_QUEUE_SIZE      0x0C
+#define VIRTIO_QUEUE_SEL       0x0E
+#define VIRTIO_QUEUE_NOTIFY    0x10
+#define VIRTIO_STATUS          0x12
+#define VIRTIO_ISR             0x13  // reading it acks the interrupt
+#define VIRTIO_CONFIG          0x14  // device-specific, without MSI-X
+
+// VIRTIO_STATUS bits
+#define VIRTIO_ST_ACK          0x1
+#define VIRTIO_ST_DRIVER       0x2
+#define VIRTIO_ST_DRIVER_OK    0x4
+#define VIRTIO_ST_FAILED       0x80
+
+// The block device's config space starts with its
+// capacity, a 64-bit count of 512-byte sectors.
+#define VIRTIO_BLK_CAPACITY    (VIRTIO_CONFIG + 0)
+
+// A virtqueue is a descriptor table, followed by the ring
+// of descriptors the driver makes available to the device
+// and, on the next page boundary, the ring of descriptors
+// the device has used.
+struct vring_desc {
+  uint64 addr;     // physical address
+  uint len;
+  ushort flags;
+  ushort next;     // next descriptor of the chain, if VRING_DESC_NEXT
+};
+
+#define VRING_DESC_NEXT   0x1
+#define VRING_DESC_WRITE  0x2  // device writes (vs reads) the buffer
+
+struct vring_avail {
+  ushort flags;
+  ushort idx;      // where the driver puts the next entry
+  ushort ring[];
+};
+
+struct vring_used_elem {
+  uint id;         // head of the finished chain
+  uint len;
+};
+
+struct vring_used {
+  ushort flags;
+  ushort idx;      // where the device puts the next entry
+  struct vring_used_elem ring[];
+};
+
+#define VRING_USED_NO_NOTIFY  0x1  // device needs no notify
+
+// A block request is a chain of a header, the data and a
+// status byte that the device fills in.
+struct virtio_blk_req {
+  uint type;
+  uint reserved;
+  uint64 sector;
+};
+
+#define VIRTIO_BLK_T_IN   0  // read
+#define VIRTIO_BLK_T_OUT  1  // write
+#define VIRTIO_BLK_S_OK   0
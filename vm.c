@@ -6,7 +6,11 @@
 #include "memlayout.h"
 #include "mmu.h"
 #include "proc.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "vmspace.h"
 #include "elf.h"
+#include "mman.h"
 
 #define BUF_SIZE PGSIZE/4
 
@@ -34,7 +38,7 @@ seginit(void)
 // Return the address of the PTE in page table pgdir
 // that corresponds to virtual address va.  If alloc!=0,
 // create any required page table pages.
-static pte_t *
+pte_t *
 walkpgdir(pde_t *pgdir, const void *va, int alloc){
   pde_t *pde;
   pte_t *pgtab;
@@ -58,7 +62,7 @@ walkpgdir(pde_t *pgdir, const void *va, int alloc){
 // Create PTEs for virtual addresses starting at va that refer to
 // physical addresses starting at pa. va and size might not
 // be page-aligned.
-static int
+int
 mappages(pde_t *pgdir, void *va, uint size, uint pa, int perm){
   char *a, *last;
   pte_t *pte;
@@ -136,8 +140,6 @@ switchuvm(struct proc *p)
     panic("switchuvm: no process");
   if(p->kstack == 0)
     panic("switchuvm: no kstack");
-  if(p->pgdir == 0)
-    panic("switchuvm: no pgdir");
 
   pushcli();
   mycpu()->gdt[SEG_TSS] = SEG16(STS_T32A, &mycpu()->ts,
@@ -149,7 +151,9 @@ switchuvm(struct proc *p)
   // forbids I/O instructions (e.g., inb and outb) from user space
   mycpu()->ts.iomb = (ushort) 0xFFFF;
   ltr(SEG_TSS << 3);
-  lcr3(V2P(p->pgdir));  // switch to process's address space
+  // switch to process's address space, or stay in the kernel's
+  // if p is an exiting thread that gave up its own
+  lcr3(V2P(p->vm ? p->vm->pgdir : kpgdir));
   popcli();
 }
 
@@ -192,12 +196,33 @@ loaduvm(pde_t *pgdir, char *addr, struct inode *ip, uint offset, uint sz)
   return 0;
 }
 
+// Allocate a frame for a user page. When memory runs out, the
+// buffer cache gives some back; failing that, the
+// caller stalls while the OOM killer frees some: the victim is
+// given OOM_RETRIES chances to run and exit before giving up.
+static char*
+uvmalloc(void)
+{
+  char *mem;
+  int i;
+
+  for(i = 0; i < OOM_RETRIES; i++){
+    if((mem = kalloc()) != 0)
+      return mem;
+    if(bshrink() > 0 && (mem = kalloc()) != 0)
+      return mem;
+    if(oomkill() < 0 || myproc()->killed)
+      return 0;
+    yield();
+  }
+  return kalloc();
+}
 
 int 
 accessedBit(char *va){
-  struct proc *proc = myproc();
+  struct vmspace *vm = myproc()->vm;
   uint flag;
-  pte_t *pte = walkpgdir(proc->pgdir,(void*)va,0);
+  pte_t *pte = walkpgdir(vm->pgdir,(void*)va,0);
   
   if(pte){
     flag = (*pte) & PTE_A;
@@ -208,152 +233,227 @@ accessedBit(char *va){
     panic("pte not found");
 }
 
+// Return the index of the swap slot holding va, or -1.
+// Pass (char*)0xffffffff to find a free slot.
+static int
+swapSlot(struct vmspace *vm, char *va)
+{
+  int i;
 
-struct freepg *writePageToSwapFile(char *va){
+  for(i = 0; i < MAX_PSYC_PAGES; i++)
+    if(vm->swap_space_pages[i].va == va)
+      return i;
+  return -1;
+}
 
-#if NFU
+#ifndef NONE
+// Return the resident-page entry for va, or 0.
+static struct freepg*
+residentPage(struct vmspace *vm, char *va)
+{
+  int i;
 
-  struct proc *proc = myproc();
-  int i = 0,j;
-  uint maxIndex = -1;
-  uint maxAge = 0;
-
-  struct freepg *candidate;
-
-  while(i<MAX_PSYC_PAGES){
-    if(proc->swap_space_pages[i].va == (char*)0xffffffff){
-      for(j=0; j<MAX_PSYC_PAGES; j++){
-        if(proc->free_pages[j].va != (char*)0xffffffff){
-          if(proc->free_pages[j].age > maxAge){
-              maxAge = proc->free_pages[j].age;
-              maxIndex = j;
-            }
-        }
-      }
-      if(maxIndex == -1)
-        panic("nfuWrite: no free page to swap");
-      candidate = &proc->free_pages[maxIndex];
-
-      pte_t *pte1 = walkpgdir(proc->pgdir, (void*)candidate->va, 0);
-      if(!pte1)
-        panic("writePageToSwapFile: nfuWrite pte1 is empty");
-      
-      acquire(&tickslock);
-      if((*pte1) && PTE_A){
-        candidate->age+=1;;
-        *pte1 &= ~PTE_A;
-      }
-      release(&tickslock);
-      proc->swap_space_pages[i].va = candidate->va;
+  for(i = 0; i < MAX_PSYC_PAGES; i++)
+    if(vm->free_pages[i].va == va)
+      return &vm->free_pages[i];
+  return 0;
+}
 
-      int test_num = writeToSwapFile(proc, (char*)PTE_ADDR(candidate->va), i * PGSIZE, PGSIZE);
-      if (test_num == 0)
-        return 0;
-      kfree((char*)PTE_ADDR(P2V_WO(*walkpgdir(proc->pgdir, candidate->va, 0))));
-      *pte1 = PTE_W | PTE_U | PTE_PG;
-      proc->page_swapped_count+=1;
-      proc->swap_file_pages+=1;
-
-      lcr3(V2P(proc->pgdir));
-      candidate->va = va;
-      return candidate;
-    }
-    i++;
-  }
-  panic("writePageToSwapFile: NFU no slot for swapped page");
+#if SCFIFO
+// Move fp, already on the SCFIFO list, to its head.
+static void
+scfifoToHead(struct vmspace *vm, struct freepg *fp)
+{
+  if(vm->head == fp)
+    return;
+  fp->prev->next = fp->next;
+  if(fp->next)
+    fp->next->prev = fp->prev;
+  else
+    vm->tail = fp->prev;
+  fp->prev = 0;
+  fp->next = vm->head;
+  vm->head->prev = fp;
+  vm->head = fp;
+}
+#endif
+
+#if FIFO
+// Insert fp at the head of the FIFO list, as the newest page.
+static void
+fifoPush(struct vmspace *vm, struct freepg *fp)
+{
+  fp->next = vm->head;
+  vm->head = fp;
+}
+#endif
 
+// Stop tracking the resident page fp.
+static void
+removeFreePage(struct vmspace *vm, struct freepg *fp)
+{
+#if FIFO
+  struct freepg *last;
+
+  if(vm->head == fp)
+    vm->head = fp->next;
+  else {
+    for(last = vm->head; last && last->next != fp; last = last->next)
+      ;
+    if(last)
+      last->next = fp->next;
+  }
 #elif SCFIFO
+  if(fp->prev)
+    fp->prev->next = fp->next;
+  else
+    vm->head = fp->next;
+  if(fp->next)
+    fp->next->prev = fp->prev;
+  else
+    vm->tail = fp->prev;
+#endif
+  fp->va = (char*)0xffffffff;
+  fp->next = 0;
+  fp->prev = 0;
+  fp->age = 0;
+  fp->flags = 0;
+  vm->main_mem_pages--;
+}
+#endif
 
-  struct proc *proc = myproc();
-  int i = 0;
-  struct freepg *itr, *init_itr;
-  while(i<MAX_PSYC_PAGES){
-    if(proc->swap_space_pages[i].va == (char*)0xffffffff){
-
-      if(proc->head == 0 || proc->head->next == 0)
-        panic("scFifoWrite: not enough phy memory pages");
-      itr = proc->tail;
-      init_itr = proc->tail;
-      do{
-      proc->tail = proc->tail->prev;
-      proc->tail->next = 0;
-      itr->prev = 0;
-      itr->next = proc->head;
-      proc->head->prev = itr;
-      proc->head = itr;
-      itr = proc->tail;
-      }while(accessedBit(proc->head->va) && itr !=init_itr);
-    
-      proc->swap_space_pages[i].va = proc->head->va;
-      int num = writeToSwapFile(proc, (char*)PTE_ADDR(proc->head->va), i * PGSIZE, PGSIZE);
-      if(num == 0)
-        return 0;
-      pte_t *pte1 = walkpgdir(proc->pgdir, (void*)proc->head->va, 0);
-      if(!*pte1)
-        panic("writePageToSwapFile: pte1 not found");
-      
-      kfree((char*)PTE_ADDR(P2V_WO(*walkpgdir(proc->pgdir, proc->head->va, 0))));
-      *pte1 = PTE_W | PTE_U | PTE_PG;
-      ++proc->page_swapped_count;
-      ++proc->swap_file_pages;
-
-      lcr3(V2P(proc->pgdir));
-      proc->head->va = va;
-      return proc->head;
+// Choose the resident page to evict according to the paging scheme.
+// mlock()ed pages and keep are never chosen, and pages marked
+// FP_EVICT by sequential access go before any other.
+// The FIFO victim is unlinked from the list and the SCFIFO victim
+// is moved to the head, where its entry will hold the incoming page.
+// Returns 0 if every resident page is pinned.
+static struct freepg*
+selectVictim(struct vmspace *vm, char *keep)
+{
+#if NFU
+  struct freepg *fp, *victim = 0;
+
+  for(fp = vm->free_pages; fp < &vm->free_pages[MAX_PSYC_PAGES]; fp++){
+    if(fp->va == (char*)0xffffffff || fp->va == keep || (fp->flags & FP_LOCKED))
+      continue;
+    if(fp->flags & FP_EVICT)
+      return fp;
+    if(victim == 0 || fp->age > victim->age)
+      victim = fp;
+  }
+  return victim;
+
+#elif SCFIFO
+  struct freepg *fp;
+  int n;
+
+  if(vm->head == 0 || vm->head->next == 0)
+    panic("selectVictim: not enough phy memory pages");
+  for(fp = vm->head; fp != 0; fp = fp->next){
+    if(fp->va != keep && (fp->flags & (FP_LOCKED|FP_EVICT)) == FP_EVICT){
+      scfifoToHead(vm, fp);
+      return fp;
     }
-    i++;
   }
-  panic("writePageToSwapFile: No free page available in the swap space");
+  // Give each page a second chance: move the tail to the head
+  // until it finds one not accessed since it was last checked.
+  // Two rounds are enough to clear every accessed bit.
+  for(n = 0; n < 2*MAX_PSYC_PAGES; n++){
+    fp = vm->tail;
+    scfifoToHead(vm, fp);
+    if(fp->va == keep || (fp->flags & FP_LOCKED))
+      continue;
+    if(!accessedBit(fp->va))
+      return fp;
+  }
+  return 0;
 
 #elif FIFO
+  struct freepg *fp, *prev, *victim = 0, *vprev = 0;
 
-  struct proc *proc = myproc();
-  int i=0;
-  struct freepg *temp, *last;
-  while(i<MAX_PSYC_PAGES){
-    if(proc->swap_space_pages[i].va == (char*)0xffffffff){
-      temp = proc->head;
-      if(temp == 0)
-        panic("fifoWrite: proc->head is NULL");
-      if(temp->next == 0)
-        panic("fifoWrite: only one page in phy mem");
-      while(temp->next->next!=0)
-        temp = temp->next;
-      last = temp->next;
-      temp->next = 0;
-      proc->swap_space_pages[i].va = last->va;
-      int num = writeToSwapFile(proc,(char*)PTE_ADDR(last->va),i*PGSIZE, PGSIZE);
-      if(num == 0)
-        return 0;
-      pte_t *pte1 = walkpgdir(proc->pgdir, (void*)last->va, 0);
-      if(!*pte1)
-        panic("writePageToSwapFile: pte1 is empty");
-      kfree((char*)PTE_ADDR(P2V_WO(*walkpgdir(proc->pgdir, last->va, 0))));
-      *pte1 = PTE_W | PTE_U | PTE_PG;
-      ++proc->page_swapped_count;
-      ++proc->swap_file_pages;
-      lcr3(V2P(proc->pgdir));
-      return last;
-    }  
-    i++;
+  if(vm->head == 0)
+    panic("selectVictim: vm->head is NULL");
+  // The oldest page is at the end of the list.
+  for(prev = 0, fp = vm->head; fp != 0; prev = fp, fp = fp->next){
+    if(fp->va == keep || (fp->flags & FP_LOCKED))
+      continue;
+    if(victim == 0 || (fp->flags & FP_EVICT) || !(victim->flags & FP_EVICT)){
+      victim = fp;
+      vprev = prev;
+    }
   }
-  panic("writePagesToSwapFile: FIFO no slot for swapped page");
-  
+  if(victim == 0)
+    return 0;
+  if(vprev)
+    vprev->next = victim->next;
+  else
+    vm->head = victim->next;
+  victim->next = 0;
+  return victim;
+
+#else
+  return 0;
 #endif
+}
+
+// Make room for va, a page about to become resident: write a victim
+// out to a free swap slot and return its entry, now holding va.
+// Return 0 if swap space is exhausted or the write fails.
+// The caller holds vm->lock.
+struct freepg *writePageToSwapFile(char *va){
 
-  return 0;  
+  struct vmspace *vm = myproc()->vm;
+  struct freepg *victim;
+  pte_t *pte, old;
+  int i;
+
+  if(vm->swapFile == 0 || (i = swapSlot(vm, (char*)0xffffffff)) < 0)
+    return 0;
+  if((victim = selectVictim(vm, va)) == 0)
+    return 0;
+  pte = walkpgdir(vm->pgdir, victim->va, 0);
+  if(!pte || !(*pte & PTE_P))
+    panic("writePageToSwapFile: victim pte is empty");
+
+  // Unmap the victim before writing it out, so that no other
+  // thread can change it meanwhile; one that touches it faults
+  // and waits for vm->lock.
+  old = *pte;
+  *pte = PTE_W | PTE_U | PTE_PG;
+  tlbflush(vm);
+  if(writeToSwapFile(vm, P2V(PTE_ADDR(old)), i * PGSIZE, PGSIZE) != PGSIZE){
+    *pte = old;
+#if FIFO
+    fifoPush(vm, victim);
+#endif
+    return 0;
+  }
+  vm->swap_space_pages[i].va = victim->va;
+  vm->swap_space_pages[i].flags = victim->flags & ~FP_EVICT;
+  kfree(P2V(PTE_ADDR(old)));
+  vm->page_swapped_count++;
+  vm->swap_file_pages++;
+
+  victim->va = va;
+  victim->age = 0;
+  victim->flags = 0;
+#if FIFO
+  fifoPush(vm, victim);
+#endif
+  return victim;
 }
 
 
 void recordNewPage(char *va){
 
   #if NFU 
-    struct proc *proc = myproc();
+    struct vmspace *vm = myproc()->vm;
     int i = 0;
     while(i<MAX_PSYC_PAGES){
-      if(proc->free_pages[i].va == (char*)0xffffffff){
-        proc->free_pages[i].va = va;
-        proc->main_mem_pages++;
+      if(vm->free_pages[i].va == (char*)0xffffffff){
+        vm->free_pages[i].va = va;
+        vm->main_mem_pages++;
         return;
       }
       i++;
@@ -362,18 +462,19 @@ void recordNewPage(char *va){
   
   #elif SCFIFO
     struct proc *proc = myproc();
+    struct vmspace *vm = proc->vm;
     int i=0;
     while(i < MAX_PSYC_PAGES){
-      if (proc->free_pages[i].va == (char*)0xffffffff){
-        proc->free_pages[i].va = va;
-        proc->free_pages[i].next = proc->head;
-        proc->free_pages[i].prev = 0;
-        if(proc->head != 0)
-          proc->head->prev = &proc->free_pages[i];
+      if (vm->free_pages[i].va == (char*)0xffffffff){
+        vm->free_pages[i].va = va;
+        vm->free_pages[i].next = vm->head;
+        vm->free_pages[i].prev = 0;
+        if(vm->head != 0)
+          vm->head->prev = &vm->free_pages[i];
         else
-          proc->tail = &proc->free_pages[i];
-        proc->head = &proc->free_pages[i];
-        proc->main_mem_pages++;
+          vm->tail = &vm->free_pages[i];
+        vm->head = &vm->free_pages[i];
+        vm->main_mem_pages++;
         return;
       }
       i++;
@@ -383,13 +484,14 @@ void recordNewPage(char *va){
   
   #elif FIFO 
     struct proc *proc = myproc();
+    struct vmspace *vm = proc->vm;
     int i=0;
     while(i<MAX_PSYC_PAGES){
-      if(proc->free_pages[i].va == (char*)0xffffffff){
-        proc->free_pages[i].va = va;
-        proc->free_pages[i].next = proc->head;
-        proc->head = &proc->free_pages[i];
-        proc->main_mem_pages++;
+      if(vm->free_pages[i].va == (char*)0xffffffff){
+        vm->free_pages[i].va = va;
+        vm->free_pages[i].next = vm->head;
+        vm->head = &vm->free_pages[i];
+        vm->main_mem_pages++;
         return;
       }
       i++;
@@ -408,7 +510,7 @@ allocuvm(pde_t *pgdir, uint oldsz, uint newsz)
   char *mem;
   uint a;
 
-  if(newsz >= KERNBASE)
+  if(newsz >= SHMBASE)
     return 0;
   if(newsz < oldsz)
     return oldsz;
@@ -417,34 +519,32 @@ allocuvm(pde_t *pgdir, uint oldsz, uint newsz)
   
   #ifndef NONE
     struct proc *proc = myproc();
+    struct vmspace *vm = proc->vm;
   #endif
 
   for(; a < newsz; a += PGSIZE){
+    mem = uvmalloc();
+    if(mem == 0){
+      cprintf("allocuvm out of memory\n");
+      deallocuvm(pgdir, newsz, oldsz);
+      return 0;
+    }
+
   #ifndef NONE
-    //cprintf("number of test pages = %d\n",proc->main_mem_pages);
-    struct freepg *last;
+    //cprintf("number of test pages = %d\n",vm->main_mem_pages);
     uint newpage = 1;
-    if(proc->main_mem_pages >= MAX_PSYC_PAGES && proc->pid > 2){
-      last = writePageToSwapFile((char*)a);
-      if(last == 0)
-        panic("Cannot write to swap file :: allocuvm");
-        
-      #if FIFO
-      //cprintf("should be called fifo part\n");
-        last->va = (char*)a;
-        last->next = proc->head;
-        proc->head = last;
-      #endif
+    if(vm->main_mem_pages >= MAX_PSYC_PAGES && proc->pid > 2){
+      if(writePageToSwapFile((char*)a) == 0){
+        // Out of swap space: fail the allocation rather than the kernel.
+        cprintf("allocuvm out of swap space\n");
+        kfree(mem);
+        deallocuvm(pgdir, newsz, oldsz);
+        return 0;
+      }
       newpage = 0;
     }
   #endif
 
-    mem = kalloc();
-    if(mem == 0){
-      cprintf("allocuvm out of memory\n");
-      deallocuvm(pgdir, newsz, oldsz);
-      return 0;
-    }
     #ifndef NONE
       if(newpage){
         recordNewPage((char*)a);
@@ -463,185 +563,348 @@ allocuvm(pde_t *pgdir, uint oldsz, uint newsz)
 }
 
 
-void swapPages(uint addr){
+#ifndef NONE
+// Bring the swapped-out page at addr back into memory. The victim
+// it replaces is written to the swap slot addr leaves free.
+// Return -1 if no page can be evicted or the swap file fails.
+static int
+swapIn(struct vmspace *vm, uint addr, char *keep)
+{
+  char buf[BUF_SIZE];
+  struct freepg *victim;
+  pte_t *pte1, *pte2, old;
+  char *mem;
+  int i, off, flags;
+
+  if((i = swapSlot(vm, (char*)addr)) < 0)
+    panic("swapIn: no slot for swapped page");
+  if((victim = selectVictim(vm, keep)) == 0)
+    return -1;
+  pte1 = walkpgdir(vm->pgdir, victim->va, 0);
+  pte2 = walkpgdir(vm->pgdir, (void*)addr, 0);
+  if(!pte1 || !(*pte1 & PTE_P) || !pte2)
+    panic("swapIn: pte is empty");
+
+  // Unmap the victim, as in writePageToSwapFile(), then
+  // exchange its frame contents with the swap slot.
+  old = *pte1;
+  *pte1 = PTE_U | PTE_W | PTE_PG;
+  tlbflush(vm);
+  mem = P2V(PTE_ADDR(old));
+  for(off = 0; off < PGSIZE; off += BUF_SIZE){
+    memset(buf, 0, BUF_SIZE);
+    if(readFromSwapFile(vm, buf, i * PGSIZE + off, BUF_SIZE) < 0 ||
+       writeToSwapFile(vm, mem + off, i * PGSIZE + off, BUF_SIZE) != BUF_SIZE){
+      *pte1 = old;
+#if FIFO
+      fifoPush(vm, victim);
+#endif
+      return -1;
+    }
+    memmove(mem + off, buf, BUF_SIZE);
+  }
+  flags = vm->swap_space_pages[i].flags;
+  vm->swap_space_pages[i].va = victim->va;
+  vm->swap_space_pages[i].flags = victim->flags & ~FP_EVICT;
+  *pte2 = PTE_ADDR(old) | PTE_U | PTE_W | PTE_P; // access bit is zeroed...
+
+  victim->va = (char*)addr;
+  victim->age = 0;
+  victim->flags = flags;
+#if FIFO
+  fifoPush(vm, victim);
+#endif
+  vm->page_swapped_count++;
+  return 0;
+}
+
+// Map a fresh zeroed page at addr, a page whose contents
+// madvise(MADV_DONTNEED) dropped.
+static int
+zeroFillPage(struct vmspace *vm, uint addr)
+{
+  char *mem;
+
+  if((mem = uvmalloc()) == 0)
+    return -1;
+  if(vm->main_mem_pages >= MAX_PSYC_PAGES){
+    if(writePageToSwapFile((char*)addr) == 0){
+      kfree(mem);
+      return -1;
+    }
+  } else
+    recordNewPage((char*)addr);
+  memset(mem, 0, PGSIZE);
+  *walkpgdir(vm->pgdir, (void*)addr, 0) = V2P(mem) | PTE_W | PTE_U | PTE_P;
+  return 0;
+}
+
+// Make the non-resident page at addr resident.
+static int
+pageIn(struct vmspace *vm, uint addr, char *keep)
+{
+  if(swapSlot(vm, (char*)addr) >= 0)
+    return swapIn(vm, addr, keep);
+  return zeroFillPage(vm, addr);
+}
+#endif
+
+// Handle a page fault on the paged-out page at addr.
+// Threads sharing the address space fault one at a time.
+// Return -1, with the process killed, if it cannot be paged in.
+int swapPages(uint addr){
 
   struct proc *proc = myproc();
+  int r = 0;
   if (proc->pid <2) {
-    return;
+    return 0;
   }
 
-  #if NFU 
+#ifndef NONE
+  struct vmspace *vm = proc->vm;
+  struct freepg *fp;
+  pte_t *pte;
+  int i;
 
-    int i = 0,j = 0;
-    char buf[BUF_SIZE];
-    uint maxAge = 0;
-    uint maxIndex = -1;
-    struct freepg *candidate;
-    pte_t *pte1, *pte2;
-    while(j < MAX_PSYC_PAGES){
-      if (proc->free_pages[j].va != (char*)0xffffffff){
-        if (proc->free_pages[j].age > maxAge){
-          maxAge = proc->free_pages[j].age;
-          maxIndex = j;
-        }
-      }
-      j++;
+  acquiresleep(&vm->lock);
+  // Another thread may have paged it in while we waited.
+  pte = walkpgdir(vm->pgdir, (char*)addr, 0);
+  if(pte == 0 || (*pte & (PTE_P|PTE_PG)) != PTE_PG)
+    goto done;
+  vm->page_fault_count++;
+  if(pageIn(vm, addr, (char*)addr) < 0){
+    cprintf("pid %d %s: cannot page in 0x%x, out of memory\n",
+            proc->pid, proc->name, addr);
+    proc->killed = 1;
+    r = -1;
+    goto done;
+  }
+  if((fp = residentPage(vm, (char*)addr)) == 0 || !(fp->flags & FP_SEQ))
+    goto done;
+
+  // Sequential access: the page behind will not be needed again
+  // soon, so evict it first, and read the next page ahead.
+  if((fp = residentPage(vm, (char*)(addr - PGSIZE))) != 0 && (fp->flags & FP_SEQ))
+    fp->flags |= FP_EVICT;
+  if(addr + PGSIZE < vm->sz && (i = swapSlot(vm, (char*)(addr + PGSIZE))) >= 0 &&
+     (vm->swap_space_pages[i].flags & FP_SEQ))
+    swapIn(vm, addr + PGSIZE, (char*)addr);
+done:
+  releasesleep(&vm->lock);
+#endif
+  return r;
+}
+
+// Round [addr, addr+len) out to pages in *first and *last,
+// checking it lies within the process image.
+static int
+userRange(struct vmspace *vm, char *addr, uint len, uint *first, uint *last)
+{
+  if(len == 0 || (uint)addr + len < (uint)addr || (uint)addr + len > vm->sz)
+    return -1;
+  *first = PGROUNDDOWN((uint)addr);
+  *last = PGROUNDUP((uint)addr + len);
+  return 0;
+}
+
+// Pin the pages in [addr, addr+len) in memory, paging in any that
+// are swapped out. At most MAX_PSYC_PAGES-1 pages may be locked,
+// so the replacement policies always have a victim left.
+static int
+lockPages(struct vmspace *vm, char *addr, uint len)
+{
+  uint a, first, last;
+
+  if(userRange(vm, addr, len, &first, &last) < 0)
+    return -1;
+
+#ifndef NONE
+  struct freepg *fp;
+  int n;
+
+  n = 0;
+  for(fp = vm->free_pages; fp < &vm->free_pages[MAX_PSYC_PAGES]; fp++)
+    if(fp->va != (char*)0xffffffff && (fp->flags & FP_LOCKED))
+      n++;
+  for(a = first; a < last; a += PGSIZE)
+    if((fp = residentPage(vm, (char*)a)) == 0 || !(fp->flags & FP_LOCKED))
+      n++;
+  if(n > MAX_PSYC_PAGES - 1)
+    return -1;
+
+  for(a = first; a < last; a += PGSIZE){
+    if((fp = residentPage(vm, (char*)a)) == 0 && vm->swapFile){
+      if(pageIn(vm, a, (char*)a) < 0)
+        return -1;
+      fp = residentPage(vm, (char*)a);
     }
-    if(maxIndex != -1)
-      candidate = &proc->free_pages[maxIndex];
-    else
-      panic("NO swap page found :: nfuSwap");
-    
-    pte1 = walkpgdir(proc->pgdir, (void*)candidate->va, 0);
-    if(!*pte1)  
-      panic("Pte1 is empty :: nfu :: swapPages");
-    acquire(&tickslock);
-    if((*pte1) & PTE_A){
-      candidate->age++;
-      *pte1 &= ~PTE_A;
+    if(fp)
+      fp->flags |= FP_LOCKED;
+  }
+#else
+  (void)a;
+#endif
+  return 0;
+}
+
+// Let the pages in [addr, addr+len) be paged out again.
+static int
+unlockPages(struct vmspace *vm, char *addr, uint len)
+{
+  uint a, first, last;
+
+  if(userRange(vm, addr, len, &first, &last) < 0)
+    return -1;
+#ifndef NONE
+  struct freepg *fp;
+
+  for(a = first; a < last; a += PGSIZE)
+    if((fp = residentPage(vm, (char*)a)) != 0)
+      fp->flags &= ~FP_LOCKED;
+#else
+  (void)a;
+#endif
+  return 0;
+}
+
+// Drop the contents of the pages in [first, last): their frames
+// and swap slots are freed now, and the next touch of each page
+// maps a zero page.
+static int
+dropPages(struct vmspace *vm, uint first, uint last)
+{
+  uint a;
+  pte_t *pte;
+  char *mem;
+
+#ifndef NONE
+  struct freepg *fp;
+  int i;
+
+  for(a = first; a < last; a += PGSIZE)
+    if((fp = residentPage(vm, (char*)a)) != 0 && (fp->flags & FP_LOCKED))
+      return -1;
+  if(vm->swapFile){
+    for(a = first; a < last; a += PGSIZE){
+      if((pte = walkpgdir(vm->pgdir, (void*)a, 0)) == 0)
+        continue;
+      if((*pte & PTE_P) && (fp = residentPage(vm, (char*)a)) != 0){
+        removeFreePage(vm, fp);
+        mem = P2V(PTE_ADDR(*pte));
+        *pte = PTE_U | PTE_W | PTE_PG;
+        tlbflush(vm);
+        kfree(mem);
+      } else if((*pte & PTE_PG) && (i = swapSlot(vm, (char*)a)) >= 0){
+        vm->swap_space_pages[i].va = (char*)0xffffffff;
+        vm->swap_space_pages[i].flags = 0;
+        vm->swap_file_pages--;
+      }
     }
-    release(&tickslock);
-    i = 0; 
-    while(i < MAX_PSYC_PAGES){
-      if (proc->swap_space_pages[i].va == (char*)PTE_ADDR(addr)){
-        proc->swap_space_pages[i].va = candidate->va;
-        pte2 = walkpgdir(proc->pgdir, (void*)addr, 0);
-        if (!*pte2)
-          panic("nfuSwap: pte2 is empty");
-        *pte2 = PTE_ADDR(*pte1) | PTE_U | PTE_W | PTE_P;// access bit is zeroed...
-        j = 0;
-        while(j < 4) {
-          int loc = (i * PGSIZE) + ((PGSIZE / 4) * j);
-          int addroffset = ((PGSIZE / 4) * j);
-          memset(buf, 0, BUF_SIZE);
-          readFromSwapFile(proc, buf, loc, BUF_SIZE);
-          writeToSwapFile(proc, (char*)(P2V_WO(PTE_ADDR(*pte1)) + addroffset), loc, BUF_SIZE);
-          memmove((void*)(PTE_ADDR(addr) + addroffset), (void*)buf, BUF_SIZE);
-          j++;
-        }
-        *pte1 = PTE_U | PTE_W | PTE_PG;
-        candidate->va = (char*)PTE_ADDR(addr);
-        candidate->age = 0;
-        lcr3(V2P(proc->pgdir));
-        proc->page_swapped_count++;
-        return;
-      }    
-      i++;  
+    return 0;
+  }
+#endif
+
+  // Without a swap file a dropped page cannot fault back in,
+  // so just zero it.
+  for(a = first; a < last; a += PGSIZE){
+    pte = walkpgdir(vm->pgdir, (void*)a, 0);
+    if(pte && (*pte & PTE_P) && (*pte & PTE_U)){
+      mem = P2V(PTE_ADDR(*pte));
+      memset(mem, 0, PGSIZE);
     }
-    panic("No slot for swapped page :: nfu :: swapPages");
+  }
+  return 0;
+}
 
-  #elif SCFIFO
+// Advise the paging code how [addr, addr+len) will be used.
+static int
+advisePages(struct vmspace *vm, char *addr, uint len, int advice)
+{
+  uint first, last;
 
-    int i,j;
-    char buf[BUF_SIZE];
-    pte_t *pte1, *pte2;
-    struct freepg *itr, *init_itr;
-
-    if (proc->head == 0)
-      panic("Proc->head is NULL :: scfifo :: swapPages");
-    if (proc->head->next == 0)
-      panic("Single page in physical memory :: scfifo :: swapPages");
-
-    itr = proc->tail;
-    init_itr = proc->tail;
-    do{
-      //move mover from tail to head
-      proc->tail = proc->tail->prev;
-      proc->tail->next = 0;
-      itr->prev = 0;
-      itr->next = proc->head;
-      proc->head->prev = itr;
-      proc->head = itr;
-      itr = proc->tail;
-    }while(accessedBit(proc->head->va) && itr != init_itr);
-
-    pte1 = walkpgdir(proc->pgdir, (void*)proc->head->va, 0);
-    if (!*pte1)
-      panic("SCFIFO pte1 is empty :: swapPages");
-
-    //find a swap file page descriptor slot
-    i = 0;
-    while(i < MAX_PSYC_PAGES){
-      if (proc->swap_space_pages[i].va == (char*)PTE_ADDR(addr)){
-        proc->swap_space_pages[i].va = proc->head->va;
-        pte2 = walkpgdir(proc->pgdir, (void*)addr, 0);
-        if (!*pte2)
-          panic("SCFIFO pte2 is empty :: swapPages");
-        *pte2 = PTE_ADDR(*pte1) | PTE_U | PTE_W | PTE_P;// access bit is zeroed...
-        j = 0;
-        while(j < 4) {
-          int loc = (i * PGSIZE) + ((PGSIZE / 4) * j);
-          int addroffset = ((PGSIZE / 4) * j);
-          memset(buf, 0, BUF_SIZE);
-          readFromSwapFile(proc, buf, loc, BUF_SIZE);
-          writeToSwapFile(proc, (char*)(P2V_WO(PTE_ADDR(*pte1)) + addroffset), loc, BUF_SIZE);
-          memmove((void*)(PTE_ADDR(addr) + addroffset), (void*)buf, BUF_SIZE);
-          j++;
-        }
-        *pte1 = PTE_U | PTE_W | PTE_PG;
-        proc->head->va = (char*)PTE_ADDR(addr);
-        lcr3(V2P(proc->pgdir));
-        proc->page_swapped_count++;
-        return; 
+  if(userRange(vm, addr, len, &first, &last) < 0)
+    return -1;
+  if(advice == MADV_DONTNEED)
+    return dropPages(vm, first, last);
+
+#ifndef NONE
+  struct freepg *fp;
+  uint a;
+  int i, n;
+
+  switch(advice){
+  case MADV_NORMAL:
+  case MADV_SEQUENTIAL:
+    for(a = first; a < last; a += PGSIZE){
+      if((fp = residentPage(vm, (char*)a)) == 0){
+        if((i = swapSlot(vm, (char*)a)) < 0)
+          continue;
+        fp = &vm->swap_space_pages[i];
       }
-      i++;
+      if(advice == MADV_SEQUENTIAL)
+        fp->flags |= FP_SEQ;
+      else
+        fp->flags &= ~(FP_SEQ|FP_EVICT);
     }
-    panic("SCFIFO no slot for swapped page :: swapPages");
-
-  #elif FIFO
-
-    int i,j;
-    char buffer[BUF_SIZE];
-    pte_t *pte1, *pte2;
-
-    struct freepg *temp = proc->head;
-    struct freepg *last;
-
-    if(temp == 0)
-      panic("Proc->head is NULL :: fifo :: swapPages");
-    if (temp->next == 0)
-      panic("Single page in phys mem :: fifo :: swapPages");
-    // find the before-last link in the used pages list
-    while (temp->next->next != 0)
-      temp = temp->next;
-    last = temp->next;
-    temp->next = 0; 
-
-    pte1 = walkpgdir(proc->pgdir,(void*)last->va,0);  
-    if(!*pte1)
-      panic("FIFO pte1 is empty :: swapPages");
-    i = 0;
-    while(i<MAX_PSYC_PAGES){
-      if(proc->swap_space_pages[i].va == (char*)PTE_ADDR(addr)){
-        proc->swap_space_pages[i].va = last->va;
-        pte2 = walkpgdir(proc->pgdir, (void*)addr, 0);
-        if(!*pte2)
-          panic("FIFO pte2 is empty :: swapPages");
-        
-        *pte2 = PTE_ADDR(*pte1) | PTE_U | PTE_W | PTE_P;
-        j = 0;
-        while(j<4){
-          int loc = (i * PGSIZE) + ((PGSIZE / 4) * j);
-          int addroffset = ((PGSIZE / 4) * j);
-          memset(buffer,0,BUF_SIZE);
-          readFromSwapFile(proc,buffer,loc,BUF_SIZE);
-          writeToSwapFile(proc, (char*)(P2V_WO(PTE_ADDR(*pte1)) + addroffset), loc, BUF_SIZE);
-          memmove((void*)(PTE_ADDR(addr) + addroffset), (void*)buffer, BUF_SIZE);
-          j++;
-        }
-        *pte1 = PTE_U | PTE_W | PTE_PG;
-        last->next = proc->head;
-        proc->head = last;
-        last->va = (char*)PTE_ADDR(addr);
-        lcr3(V2P(proc->pgdir));
-        proc->page_swapped_count++;
-        return; 
+    return 0;
+
+  case MADV_WILLNEED:
+    // Swap in at most half of the resident set, so the
+    // prefetched pages do not evict each other.
+    n = 0;
+    for(a = first; a < last && n < MAX_PSYC_PAGES/2; a += PGSIZE){
+      if(vm->swapFile && swapSlot(vm, (char*)a) >= 0){
+        if(swapIn(vm, a, (char*)a) < 0)
+          return -1;
+        n++;
       }
-      i++;
     }
-    panic("Problem in swappages");
+    return 0;
+  }
+  return -1;
+#else
+  if(advice == MADV_NORMAL || advice == MADV_SEQUENTIAL || advice == MADV_WILLNEED)
+    return 0;
+  return -1;
+#endif
+}
 
-  #endif
+// The mlock(), munlock() and madvise() system calls run with
+// the address space locked against other threads.
+int
+mlock(char *addr, uint len)
+{
+  struct vmspace *vm = myproc()->vm;
+  int r;
+
+  acquiresleep(&vm->lock);
+  r = lockPages(vm, addr, len);
+  releasesleep(&vm->lock);
+  return r;
+}
+
+int
+munlock(char *addr, uint len)
+{
+  struct vmspace *vm = myproc()->vm;
+  int r;
+
+  acquiresleep(&vm->lock);
+  r = unlockPages(vm, addr, len);
+  releasesleep(&vm->lock);
+  return r;
+}
+
+int
+madvise(char *addr, uint len, int advice)
+{
+  struct vmspace *vm = myproc()->vm;
+  int r;
+
+  acquiresleep(&vm->lock);
+  r = advisePages(vm, addr, len, advice);
+  releasesleep(&vm->lock);
+  return r;
 }
 
 
@@ -649,82 +912,54 @@ void swapPages(uint addr){
 // newsz.  oldsz and newsz need not be page-aligned, nor does newsz
 // need to be less than oldsz.  oldsz can be larger than the actual
 // process size.  Returns the new process size.
+// If pgdir is the current address space, its paging bookkeeping
+// is updated and the TLBs of its threads flushed.
 int
 deallocuvm(pde_t *pgdir, uint oldsz, uint newsz)
 {
-  int i;
+  int i, cur;
   uint a, pa;
-  struct proc* proc = myproc();
+  struct vmspace *vm = myproc()->vm;
   pte_t *pte;
   if(newsz >= oldsz)
     return oldsz;
 
+  cur = vm != 0 && vm->pgdir == pgdir;
+
   a = PGROUNDUP(newsz);
   for(; a  < oldsz; a += PGSIZE){
     pte = walkpgdir(pgdir, (char*)a, 0);
     if(!pte)
       a = PGADDR(PDX(a) + 1, 0, 0) - PGSIZE;
+    else if(*pte & PTE_SHM){
+      // Shared frames belong to shm.c; just drop the mapping.
+      *pte = 0;
+    }
     else if((*pte & PTE_P) != 0){
       pa = PTE_ADDR(*pte);
       if(pa == 0)
         panic("kfree");
-      if(proc->pgdir == pgdir){
+      if(cur){
 #ifndef NONE
-        for(i=0; i<MAX_PSYC_PAGES; i++){
-          if(proc->free_pages[i].va == (char*)a){
-            proc->free_pages[i].va = (char*)0xffffffff;
-  #if FIFO
-            if (proc->head == &proc->free_pages[i])
-              proc->head = proc->free_pages[i].next;
-            else {
-              struct freepg *last = proc->head;
-              while (last->next != &proc->free_pages[i])
-              last = last->next;
-              last->next = proc->free_pages[i].next;
-            }
-            proc->free_pages[i].next = 0;
-  #elif SCFIFO
-            if (proc->head == &proc->free_pages[i]){
-              proc->head = proc->free_pages[i].next;
-              if(proc->head != 0)
-                proc->head->prev = 0;
-              proc->free_pages[i].next = 0;
-              proc->free_pages[i].prev = 0;
-            }
-            if (proc->tail == &proc->free_pages[i]){
-              proc->tail = proc->free_pages[i].prev;
-              if(proc->tail != 0)// should allways be true but lets be extra safe...
-                proc->tail->next = 0;
-              proc->free_pages[i].next = 0;
-              proc->free_pages[i].prev = 0;
-
-            }
-            struct freepg *last = proc->head;
-            while (last->next != 0 && last->next != &proc->free_pages[i]){
-              last = last->next;
-            }
-            last->next = proc->free_pages[i].next;
-            if (proc->free_pages[i].next != 0){
-              proc->free_pages[i].next->prev = last;
-            }
-
-  #endif     
-            proc->main_mem_pages--;
-          }    
-        }
+        struct freepg *fp;
+        if((fp = residentPage(vm, (char*)a)) != 0)
+          removeFreePage(vm, fp);
 #endif
       }
       char *v = P2V(pa);
-      kfree(v);
       *pte = 0;
+      if(cur)
+        tlbflush(vm);
+      kfree(v);
     }
-    else if((*pte & PTE_PG) && proc->pgdir == pgdir){
+    else if((*pte & PTE_PG) && cur){
       for(i=0; i<MAX_PSYC_PAGES; i++){
-        if(proc->swap_space_pages[i].va == (char*)a){
-          proc->swap_space_pages[i].va = (char*) 0xffffffff;
-          proc->swap_space_pages[i].age = 0;
-          proc->swap_space_pages[i].swaploc = 0;
-          proc->swap_file_pages--;     
+        if(vm->swap_space_pages[i].va == (char*)a){
+          vm->swap_space_pages[i].va = (char*) 0xffffffff;
+          vm->swap_space_pages[i].age = 0;
+          vm->swap_space_pages[i].swaploc = 0;
+          vm->swap_space_pages[i].flags = 0;
+          vm->swap_file_pages--;     
         }
       }
     }
@@ -783,13 +1018,14 @@ copyuvm(pde_t *pgdir, uint sz)
       panic("copyuvm: page not present");
     if (*pte & PTE_PG) {
       // cprintf("copyuvm PTR_PG\n"); // TODO delete
-      pte = walkpgdir(d, (void*) i, 1);
+      if((pte = walkpgdir(d, (void*) i, 1)) == 0)
+        goto bad;
       *pte = PTE_U | PTE_W | PTE_PG;
       continue;
     }
     pa = PTE_ADDR(*pte);
     flags = PTE_FLAGS(*pte);
-    if((mem = kalloc()) == 0)
+    if((mem = uvmalloc()) == 0)
       goto bad;
     memmove(mem, (char*)P2V(pa), PGSIZE);
     if(mappages(d, (void*)i, PGSIZE, V2P(mem), flags) < 0) {
@@ -819,6 +1055,37 @@ uva2ka(pde_t *pgdir, char *uva)
   return (char*)P2V(PTE_ADDR(*pte));
 }
 
+// Copy len bytes from p to user address va of vm, paging in
+// the pages it covers first. Unlike a plain store, this cannot
+// fault: it holds vm->lock, so no thread can unmap or page out
+// the target meanwhile. Return -1 unless [va, va+len) is in
+// user pages below sz.
+int
+copyoutvm(struct vmspace *vm, uint va, void *p, uint len)
+{
+  pte_t *pte;
+  uint a;
+  int r;
+
+  acquiresleep(&vm->lock);
+  r = -1;
+  if(va + len < va || va + len > vm->sz)
+    goto done;
+  for(a = PGROUNDDOWN(va); a < va + len; a += PGSIZE){
+    pte = walkpgdir(vm->pgdir, (char*)a, 0);
+    if(pte == 0 || !(*pte & PTE_U))
+      goto done;
+#ifndef NONE
+    if(!(*pte & PTE_P) && (!(*pte & PTE_PG) || pageIn(vm, a, (char*)a) < 0))
+      goto done;
+#endif
+  }
+  r = copyout(vm->pgdir, va, p, len);
+done:
+  releasesleep(&vm->lock);
+  return r;
+}
+
 // Copy len bytes from p to user address va in page table pgdir.
 // Most useful when pgdir is not the current page table.
 // uva2ka ensures this only works for PTE_U pages.
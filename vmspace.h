@@ -0,0 +1,48 @@
+// Paging bookkeeping for one page of a process: a resident page
+// in free_pages, or a swapped-out page in swap_space_pages.
+struct freepg {
+  char *va;
+  int age;
+  struct freepg *next;
+  struct freepg *prev;
+  uint swaploc;
+  int flags;
+};
+
+// freepg flags
+#define FP_LOCKED  0x1   // pinned in memory by mlock()
+#define FP_SEQ     0x2   // madvise(MADV_SEQUENTIAL) range
+#define FP_EVICT   0x4   // sequential page already passed; evict first
+
+// An address space with its paging state, shared by all the
+// threads of a process (see clone()). lock serializes page faults
+// and everything else that changes pgdir, sz or the page lists.
+// ref is protected by ptable.lock.
+//
+// Process memory, the first sz bytes, is laid out contiguously,
+// low addresses first:
+//   text
+//   original data and bss
+//   fixed-size stack
+//   expandable heap
+struct vmspace {
+  struct sleeplock lock;
+  int ref;                     // Threads using it
+  uint sz;                     // Size of process memory (bytes)
+  pde_t* pgdir;                // Page table
+  char shm[NSHM];              // Attached shared-memory segments
+
+  struct file *swapFile;
+  int swapid;                  // Pid in the swap file's name
+  uint agetick;                // Tick NFU last aged the pages
+
+  int main_mem_pages;
+  int swap_file_pages;
+  int page_fault_count;
+  int page_swapped_count;
+
+  struct freepg free_pages[MAX_PSYC_PAGES];
+  struct freepg swap_space_pages[MAX_PSYC_PAGES];
+  struct freepg *head;
+  struct freepg *tail;
+};